@@ -0,0 +1,804 @@
+// vim: noai:ts=4:sw=4
+
+/*
+recipe:
+> `gcc --std=c99 -O2 -pthread -DNOMAIN gausselim.c batchsolve.c -o batchsolve -lm`
+> define TEST macro for running tests: `gcc --std=c99 -pthread -DNOMAIN -DTEST gausselim.c batchsolve.c -o batchsolve -lm`
+> run: `./batchsolve [options] [<file> | -]` or `./batchsolve [options] --socket <path>`
+    --workers <n>     solver threads (default: number of online CPUs)
+    --queue <n>       systems in flight between the reader and the writer (default: 4 per worker)
+    --unordered       write solutions as soon as they are ready instead of in input order
+    --stats <file>    where to export the throughput and latency summary (default: stderr)
+
+Long running batch mode for gausselim: instead of one system per process launch,
+a stream of systems is read one per line, in the same form as gausselim's
+command line arguments, optionally preceded by an id:
+
+    [#<id>] [--no-pivot] [--no-aug] <precision> <columns> <elements...>
+
+A reader thread parses lines into a bounded set of slots, a pool of worker
+threads runs gauss_elim() on them and a writer thread streams the results back,
+so parsing, solving and output overlap. In input order the slots are a ring and
+a line waits until the line --queue lines before it has been written; with
+--unordered it takes any free slot, so a slow system holds up only its own slot. Every result line starts with the id
+(or the line number when none was given):
+
+    <id> ok <x0> <x1> ...       solution of an augmented system
+    <id> ok <a00> <a01> ...     the eliminated matrix, row by row, with --no-aug
+    <id> error <code>
+
+With --socket, the program listens on a Unix domain socket and serves one
+connection after the other until it gets SIGINT or SIGTERM. The throughput and
+latency percentiles (from reading a line to writing its result) are exported on exit.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#ifdef TEST
+#include <assert.h>
+#endif
+
+extern int gauss_elim(int m, int n, double A[][n], double* x, bool do_partial_pivoting, bool augmented_matrix, int precision);
+
+enum slot_state { SLOT_FREE, SLOT_QUEUED, SLOT_SOLVING, SLOT_DONE };
+
+/** one system on its way through the pipeline **/
+struct job
+{
+    enum slot_state state;
+    long seq;
+    char id[32];
+    bool do_partial_pivoting;
+    bool augmented_matrix;
+    int precision;
+    int m, n;
+    double* A;          // m x n, NULL if the line could not be parsed
+    char* result;       // output line, set by the worker
+    double read_time;
+};
+
+/** shared state of the reader, the workers and the writer for one input stream **/
+struct pipeline
+{
+    pthread_mutex_t lock;
+    pthread_cond_t slot_freed;      // reader waits for room
+    pthread_cond_t job_queued;      // workers wait for work
+    pthread_cond_t result_ready;    // writer waits for results
+    struct job* slots;              // ring indexed by seq % capacity when ordered
+    int capacity;
+    int* free_slots;                // stack of free slot indices when unordered
+    int free_count;
+    int* queue;                     // FIFO of slot indices waiting for a worker
+    int queue_head, queue_count;
+    long read_count;                // lines read so far
+    long written_count;             // results written so far
+    bool eof;
+    bool ordered;
+    FILE* out;
+};
+
+/** latency samples and totals across all streams **/
+struct stats
+{
+    double* latencies_us;
+    long count, capacity;
+    double start;
+};
+
+static volatile sig_atomic_t stop_requested = 0;
+static struct stats totals;
+
+static void run_pipeline(FILE* in, FILE* out, int workers, int capacity, bool ordered);
+static void* worker_main(void* arg);
+static void* writer_main(void* arg);
+static struct job* next_result(struct pipeline* P);
+static void parse_line(struct job* job, char* line, long seq);
+static void solve(struct job* job);
+static void append_format(char** buffer, size_t* length, size_t* size, const char* format, ...);
+static void record_latency(double us);
+static double now();
+#ifndef TEST
+static void export_stats(FILE* out);
+static int compare_double(const void* a, const void* b);
+static void on_signal(int signo);
+static int serve_socket(const char* path, int workers, int capacity, bool ordered);
+#endif
+
+#ifdef TEST
+/**
+ * Runs the pipeline on `input` and returns everything it wrote, to be freed by the caller.
+ */
+static char* run_on_string(const char* input, int workers, int capacity, bool ordered)
+{
+    char* output = NULL;
+    size_t output_size = 0;
+    FILE* in = fmemopen((void*)input, strlen(input), "r");
+    FILE* out = open_memstream(&output, &output_size);
+    run_pipeline(in, out, workers, capacity, ordered);
+    fclose(in);
+    fclose(out);
+    return output;
+}
+
+static int compare_line(const void* a, const void* b)
+{
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+/**
+ * Splits `text` into its lines in place, sorted, and returns how many there are.
+ */
+static int sorted_lines(char* text, char** lines, int max_lines)
+{
+    int count = 0;
+    char* save = NULL;
+    for (char* line = strtok_r(text, "\n", &save); line != NULL && count < max_lines; line = strtok_r(NULL, "\n", &save))
+    {
+        lines[count++] = line;
+    }
+    qsort(lines, count, sizeof(char*), compare_line);
+    return count;
+}
+
+static void test_1()
+{
+    // --unordered writes the same results as the input order, only permuted
+    size_t length = 0, size = 0;
+    char* input = NULL;
+    for (int t = 0; t < 60; t++)
+    {
+        int n = 1 + t % 7;
+        append_format(&input, &length, &size, "%s%d %d", t % 3 == 0 ? "--no-pivot " : "", 10 + t % 6, n + 1);
+        for (int i = 0; i < n; i++)
+        {
+            for (int j = 0; j <= n; j++) append_format(&input, &length, &size, " %d", (i == j ? 20 : 0) + (i * 7 + j * 3 + t) % 11 - 5);
+        }
+        append_format(&input, &length, &size, "\n");
+    }
+
+    char* ordered = run_on_string(input, 3, 4, true);
+    char* unordered = run_on_string(input, 3, 4, false);
+    char* ordered_lines[60];
+    char* unordered_lines[60];
+    char expected_id[16];
+    for (int t = 0; t < 60; t++)
+    {
+        // the ordered output keeps the input order, and every id is the line number
+        snprintf(expected_id, sizeof(expected_id), "%d ok", t + 1);
+        char* line = t == 0 ? strtok(ordered, "\n") : strtok(NULL, "\n");
+        assert(line != NULL && strncmp(line, expected_id, strlen(expected_id)) == 0);
+        ordered_lines[t] = line;
+    }
+    assert(strtok(NULL, "\n") == NULL);
+    qsort(ordered_lines, 60, sizeof(char*), compare_line);
+    assert(sorted_lines(unordered, unordered_lines, 60) == 60);
+    for (int t = 0; t < 60; t++)
+    {
+        assert(strcmp(ordered_lines[t], unordered_lines[t]) == 0);
+    }
+
+    free(input);
+    free(ordered);
+    free(unordered);
+}
+
+static void test_2()
+{
+    // a line that doesn't parse (no columns, or no complete row) gets an error
+    // result and leaves its neighbours alone; blank lines don't use up a line number
+    const char* input =
+        "#a 10 3 2 1 3 1 3 5\n"
+        "\n"
+        "10\n"
+        "#c 10 3\n"
+        "10 2 4 8\n";
+    const char* expected =
+        "a ok 0.8000000000 1.4000000000\n"
+        "2 error parse\n"
+        "c error parse\n"
+        "4 ok 2.0000000000\n";
+    for (int ordered = 0; ordered < 2; ordered++)
+    {
+        char* output = run_on_string(input, 2, 3, ordered);
+        char* lines[8];
+        char* expected_copy = strdup(expected);
+        char* expected_lines[8];
+        int count = sorted_lines(output, lines, 8);
+        assert(count == sorted_lines(expected_copy, expected_lines, 8));
+        for (int i = 0; i < count; i++)
+        {
+            assert(strcmp(lines[i], expected_lines[i]) == 0);
+        }
+        free(expected_copy);
+        free(output);
+    }
+}
+
+static void test_3()
+{
+    // --no-aug writes the eliminated matrix row by row
+    const char* input =
+        "#e --no-aug 10 2 1 3 2 4\n"
+        "#f --no-pivot --no-aug 10 2 1 3 2 4\n";
+    char* output = run_on_string(input, 1, 2, true);
+    assert(strcmp(output,
+        "e ok 2.0000000000 4.0000000000 0.0000000000 1.0000000000\n"
+        "f ok 1.0000000000 3.0000000000 0.0000000000 -2.0000000000\n") == 0);
+    free(output);
+}
+
+static void test_4()
+{
+    // with --unordered a slow system only holds up its own slot: the small
+    // systems behind it get the other slots and are written first
+    int n = 120;
+    size_t length = 0, size = 0;
+    char* input = NULL;
+    append_format(&input, &length, &size, "#slow 15 %d", n + 1);
+    for (int i = 0; i < n; i++)
+    {
+        for (int j = 0; j <= n; j++) append_format(&input, &length, &size, " %d", (i == j ? 100 : 0) + (i * 5 + j * 3) % 9 - 4);
+    }
+    append_format(&input, &length, &size, "\n");
+    for (int t = 0; t < 50; t++)
+    {
+        append_format(&input, &length, &size, "10 3 2 1 %d 1 3 %d\n", t, t + 1);
+    }
+
+    char* output = run_on_string(input, 2, 3, false);
+    size_t output_length = strlen(output);
+    assert(output_length > 0 && output[output_length - 1] == '\n');
+    output[output_length - 1] = '\0';
+    char* last = strrchr(output, '\n');
+    assert(last != NULL && strncmp(last + 1, "slow ok", 7) == 0);
+
+    free(input);
+    free(output);
+}
+#endif
+
+int main(int argc, char** argv)
+{
+#ifdef TEST
+    printf("Running tests\n");
+    test_1();
+    test_2();
+    test_3();
+    test_4();
+    printf("Finished running tests\n");
+
+    return 0;
+#else
+    /** input: parse command line arguments **/
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int workers = cpus > 0 ? (int)cpus : 1;
+    int capacity = 0;
+    bool ordered = true;
+    const char* socket_path = NULL;
+    const char* input_path = "-";
+    const char* stats_path = NULL;
+    for (int arg_i = 1; arg_i < argc; arg_i++)
+    {
+        if (strcmp(argv[arg_i], "--workers") == 0 && arg_i + 1 < argc)
+        {
+            workers = atoi(argv[++arg_i]);
+        }
+        else if (strcmp(argv[arg_i], "--queue") == 0 && arg_i + 1 < argc)
+        {
+            capacity = atoi(argv[++arg_i]);
+        }
+        else if (strcmp(argv[arg_i], "--unordered") == 0)
+        {
+            ordered = false;
+        }
+        else if (strcmp(argv[arg_i], "--socket") == 0 && arg_i + 1 < argc)
+        {
+            socket_path = argv[++arg_i];
+        }
+        else if (strcmp(argv[arg_i], "--stats") == 0 && arg_i + 1 < argc)
+        {
+            stats_path = argv[++arg_i];
+        }
+        else if (strncmp(argv[arg_i], "--", 2) == 0)
+        {
+            printf("WARNING: unrecognized option %s\n", argv[arg_i]);
+        }
+        else
+        {
+            input_path = argv[arg_i];
+        }
+    }
+    if (workers < 1)
+    {
+        printf("ERROR: need at least one worker\n");
+        return -1;
+    }
+    if (capacity < 1) capacity = 4 * workers;
+    // with fewer slots than workers some workers could never get a system
+    if (capacity < workers + 1) capacity = workers + 1;
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = on_signal;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    /** run **/
+    totals.start = now();
+    int ret = 0;
+    if (socket_path != NULL)
+    {
+        ret = serve_socket(socket_path, workers, capacity, ordered);
+    }
+    else
+    {
+        FILE* in = strcmp(input_path, "-") == 0 ? stdin : fopen(input_path, "r");
+        if (in == NULL)
+        {
+            fprintf(stderr, "ERROR: cannot open %s\n", input_path);
+            return -1;
+        }
+        run_pipeline(in, stdout, workers, capacity, ordered);
+        if (in != stdin) fclose(in);
+    }
+
+    /** output: throughput and latency percentiles **/
+    FILE* stats_out = stats_path != NULL ? fopen(stats_path, "w") : stderr;
+    if (stats_out == NULL)
+    {
+        fprintf(stderr, "ERROR: cannot open %s for writing\n", stats_path);
+        stats_out = stderr;
+    }
+    export_stats(stats_out);
+    if (stats_out != stderr) fclose(stats_out);
+    free(totals.latencies_us);
+
+    return ret;
+#endif
+}
+
+/**
+ * Reads systems from `in` until EOF (or a signal) and writes the results to `out`.
+ * The calling thread is the reader; the workers and the writer live as long as the stream.
+ */
+static void run_pipeline(FILE* in, FILE* out, int workers, int capacity, bool ordered)
+{
+    struct pipeline P;
+    memset(&P, 0, sizeof(P));
+    pthread_mutex_init(&P.lock, NULL);
+    pthread_cond_init(&P.slot_freed, NULL);
+    pthread_cond_init(&P.job_queued, NULL);
+    pthread_cond_init(&P.result_ready, NULL);
+    P.capacity = capacity;
+    P.slots = calloc(capacity, sizeof(struct job));
+    P.queue = malloc(sizeof(int) * capacity);
+    P.free_slots = malloc(sizeof(int) * capacity);
+    for (int s = 0; s < capacity; s++)
+    {
+        P.free_slots[s] = capacity - 1 - s;
+    }
+    P.free_count = capacity;
+    P.ordered = ordered;
+    P.out = out;
+
+    pthread_t threads[workers];
+    pthread_t writer;
+    for (int w = 0; w < workers; w++)
+    {
+        pthread_create(&threads[w], NULL, worker_main, &P);
+    }
+    pthread_create(&writer, NULL, writer_main, &P);
+
+    char* line = NULL;
+    size_t line_size = 0;
+    while (!stop_requested)
+    {
+        ssize_t length = getline(&line, &line_size, in);
+        if (length < 0) break;      // EOF, or interrupted by a signal
+        double read_time = now();
+
+        // skip blank lines without using up a sequence number
+        char* p = line;
+        while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n') p++;
+        if (*p == '\0') continue;
+
+        // parse outside the lock into a scratch job, then claim the slot
+        struct job parsed;
+        memset(&parsed, 0, sizeof(parsed));
+        parse_line(&parsed, line, P.read_count + 1);
+        parsed.read_time = read_time;
+
+        pthread_mutex_lock(&P.lock);
+        long seq = P.read_count;
+        int s;
+        if (P.ordered)
+        {
+            // the writer frees the slots in input order, so wait for this line's turn in the ring
+            s = seq % capacity;
+            while (P.slots[s].state != SLOT_FREE)
+            {
+                pthread_cond_wait(&P.slot_freed, &P.lock);
+            }
+        }
+        else
+        {
+            while (P.free_count == 0)
+            {
+                pthread_cond_wait(&P.slot_freed, &P.lock);
+            }
+            s = P.free_slots[--P.free_count];
+        }
+        struct job* slot = &P.slots[s];
+        *slot = parsed;
+        slot->seq = seq;
+        slot->state = SLOT_QUEUED;
+        P.queue[(P.queue_head + P.queue_count) % capacity] = s;
+        P.queue_count++;
+        P.read_count++;
+        pthread_cond_signal(&P.job_queued);
+        pthread_mutex_unlock(&P.lock);
+    }
+    free(line);
+
+    pthread_mutex_lock(&P.lock);
+    P.eof = true;
+    pthread_cond_broadcast(&P.job_queued);
+    pthread_cond_broadcast(&P.result_ready);
+    pthread_mutex_unlock(&P.lock);
+
+    for (int w = 0; w < workers; w++)
+    {
+        pthread_join(threads[w], NULL);
+    }
+    pthread_join(writer, NULL);
+
+    free(P.slots);
+    free(P.queue);
+    free(P.free_slots);
+    pthread_mutex_destroy(&P.lock);
+    pthread_cond_destroy(&P.slot_freed);
+    pthread_cond_destroy(&P.job_queued);
+    pthread_cond_destroy(&P.result_ready);
+}
+
+static void* worker_main(void* arg)
+{
+    struct pipeline* P = arg;
+
+    pthread_mutex_lock(&P->lock);
+    while (true)
+    {
+        while (P->queue_count == 0 && !P->eof)
+        {
+            pthread_cond_wait(&P->job_queued, &P->lock);
+        }
+        if (P->queue_count == 0) break;
+
+        struct job* job = &P->slots[P->queue[P->queue_head]];
+        P->queue_head = (P->queue_head + 1) % P->capacity;
+        P->queue_count--;
+        job->state = SLOT_SOLVING;
+        pthread_mutex_unlock(&P->lock);
+
+        solve(job);
+
+        pthread_mutex_lock(&P->lock);
+        job->state = SLOT_DONE;
+        pthread_cond_signal(&P->result_ready);
+    }
+    pthread_mutex_unlock(&P->lock);
+
+    return NULL;
+}
+
+static void* writer_main(void* arg)
+{
+    struct pipeline* P = arg;
+
+    pthread_mutex_lock(&P->lock);
+    while (true)
+    {
+        struct job* job = next_result(P);
+        if (job == NULL)
+        {
+            if (P->eof && P->written_count == P->read_count) break;
+
+            // flush only when there is nothing else to write right now
+            pthread_mutex_unlock(&P->lock);
+            fflush(P->out);
+            pthread_mutex_lock(&P->lock);
+            if (next_result(P) == NULL && !(P->eof && P->written_count == P->read_count))
+            {
+                pthread_cond_wait(&P->result_ready, &P->lock);
+            }
+            continue;
+        }
+
+        char* result = job->result;
+        double read_time = job->read_time;
+        job->result = NULL;
+        pthread_mutex_unlock(&P->lock);
+
+        fputs(result, P->out);
+        free(result);
+        record_latency((now() - read_time) * 1e6);
+
+        pthread_mutex_lock(&P->lock);
+        job->state = SLOT_FREE;
+        if (!P->ordered) P->free_slots[P->free_count++] = (int)(job - P->slots);
+        P->written_count++;
+        pthread_cond_signal(&P->slot_freed);
+    }
+    pthread_mutex_unlock(&P->lock);
+    fflush(P->out);
+
+    return NULL;
+}
+
+/**
+ * The next result to write: the oldest one, or any finished one with --unordered.
+ * Called with the lock held.
+ */
+static struct job* next_result(struct pipeline* P)
+{
+    if (P->written_count == P->read_count) return NULL;
+
+    if (P->ordered)
+    {
+        struct job* next = &P->slots[P->written_count % P->capacity];
+        return next->state == SLOT_DONE ? next : NULL;
+    }
+    for (int s = 0; s < P->capacity; s++)
+    {
+        if (P->slots[s].state == SLOT_DONE) return &P->slots[s];
+    }
+    return NULL;
+}
+
+/**
+ * Parses `[#<id>] [--no-pivot] [--no-aug] <precision> <columns> <elements...>`.
+ * On failure job->A stays NULL and job->result holds the error line.
+ */
+static void parse_line(struct job* job, char* line, long seq)
+{
+    char* save = NULL;
+    char* token = strtok_r(line, " \t\r\n", &save);
+    snprintf(job->id, sizeof(job->id), "%ld", seq);
+    job->do_partial_pivoting = true;
+    job->augmented_matrix = true;
+    job->A = NULL;
+
+    if (token != NULL && token[0] == '#')
+    {
+        snprintf(job->id, sizeof(job->id), "%s", token + 1);
+        token = strtok_r(NULL, " \t\r\n", &save);
+    }
+    while (token != NULL && strncmp(token, "--", 2) == 0)
+    {
+        if (strcmp(token, "--no-pivot") == 0)
+            job->do_partial_pivoting = false;
+        else if (strcmp(token, "--no-aug") == 0)
+            job->augmented_matrix = false;
+        token = strtok_r(NULL, " \t\r\n", &save);
+    }
+
+    char* precision = token;
+    char* columns = precision != NULL ? strtok_r(NULL, " \t\r\n", &save) : NULL;
+    int n = columns != NULL ? atoi(columns) : 0;
+    if (precision == NULL || n < 1)
+    {
+        size_t length = 0, size = 0;
+        job->result = NULL;
+        append_format(&job->result, &length, &size, "%s error parse\n", job->id);
+        return;
+    }
+    job->precision = atoi(precision);
+    job->n = n;
+
+    size_t count = 0, size = 64;
+    double* elements = malloc(sizeof(double) * size);
+    for (token = strtok_r(NULL, " \t\r\n", &save); token != NULL; token = strtok_r(NULL, " \t\r\n", &save))
+    {
+        if (count == size)
+        {
+            size *= 2;
+            elements = realloc(elements, sizeof(double) * size);
+        }
+        elements[count++] = atof(token);
+    }
+    job->m = (int)(count / n);
+    if (job->m < 1 || (job->augmented_matrix && n < 2))
+    {
+        size_t length = 0, result_size = 0;
+        free(elements);
+        job->result = NULL;
+        append_format(&job->result, &length, &result_size, "%s error parse\n", job->id);
+        return;
+    }
+    job->A = elements;
+}
+
+/**
+ * Runs gauss_elim() on the job and formats its result line.
+ */
+static void solve(struct job* job)
+{
+    if (job->A == NULL) return;     // parse error, the result is already there
+
+    int m = job->m, n = job->n;
+    double (*A)[n] = (double (*)[n])job->A;
+    double* x = malloc(sizeof(double) * n);
+    int ret = gauss_elim(m, n, A, x, job->do_partial_pivoting, job->augmented_matrix, job->precision);
+
+    size_t length = 0, size = 0;
+    char* result = NULL;
+    if (ret != 0)
+    {
+        append_format(&result, &length, &size, "%s error %d\n", job->id, ret);
+    }
+    else
+    {
+        append_format(&result, &length, &size, "%s ok", job->id);
+        if (job->augmented_matrix)
+        {
+            for (int i = 0; i < n - 1; i++) append_format(&result, &length, &size, " %8.10f", x[i]);
+        }
+        else
+        {
+            for (int i = 0; i < m; i++)
+            {
+                for (int j = 0; j < n; j++) append_format(&result, &length, &size, " %8.10f", A[i][j]);
+            }
+        }
+        append_format(&result, &length, &size, "\n");
+    }
+
+    free(x);
+    free(job->A);
+    job->A = NULL;
+    job->result = result;
+}
+
+static void append_format(char** buffer, size_t* length, size_t* size, const char* format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    int needed = vsnprintf(NULL, 0, format, args);
+    va_end(args);
+
+    if (*length + needed + 1 > *size)
+    {
+        *size = (*size + needed + 1) * 2;
+        *buffer = realloc(*buffer, *size);
+    }
+    va_start(args, format);
+    vsnprintf(*buffer + *length, *size - *length, format, args);
+    va_end(args);
+    *length += needed;
+}
+
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void record_latency(double us)
+{
+    pthread_mutex_lock(&stats_lock);
+    if (totals.count == totals.capacity)
+    {
+        totals.capacity = totals.capacity ? 2 * totals.capacity : 1024;
+        totals.latencies_us = realloc(totals.latencies_us, sizeof(double) * totals.capacity);
+    }
+    totals.latencies_us[totals.count++] = us;
+    pthread_mutex_unlock(&stats_lock);
+}
+
+static double now()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+// the statistics export and the socket server are only used by the command line main()
+#ifndef TEST
+/**
+ * Writes one CSV row: systems solved, wall time, throughput and latency percentiles.
+ */
+static void export_stats(FILE* out)
+{
+    double seconds = now() - totals.start;
+    qsort(totals.latencies_us, totals.count, sizeof(double), compare_double);
+
+    double p[4] = { 0 };
+    const double quantiles[4] = { 0.50, 0.90, 0.99, 1.0 };
+    for (int q = 0; q < 4 && totals.count > 0; q++)
+    {
+        long index = (long)(quantiles[q] * totals.count + 0.5) - 1;
+        if (index < 0) index = 0;
+        if (index >= totals.count) index = totals.count - 1;
+        p[q] = totals.latencies_us[index];
+    }
+
+    fprintf(out, "systems,seconds,systems_per_s,p50_us,p90_us,p99_us,max_us\n");
+    fprintf(out, "%ld,%.6f,%.1f,%.1f,%.1f,%.1f,%.1f\n", totals.count, seconds,
+        seconds > 0 ? totals.count / seconds : 0, p[0], p[1], p[2], p[3]);
+}
+
+static int compare_double(const void* a, const void* b)
+{
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+static void on_signal(int signo)
+{
+    (void)signo;
+    stop_requested = 1;
+}
+
+/**
+ * Accepts connections on a Unix domain socket and runs one pipeline per connection
+ * until a signal arrives.
+ */
+static int serve_socket(const char* path, int workers, int capacity, bool ordered)
+{
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+    {
+        perror("ERROR: socket");
+        return -1;
+    }
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    snprintf(address.sun_path, sizeof(address.sun_path), "%s", path);
+    unlink(path);
+    if (bind(fd, (struct sockaddr*)&address, sizeof(address)) != 0 || listen(fd, 16) != 0)
+    {
+        perror("ERROR: bind");
+        close(fd);
+        return -1;
+    }
+
+    while (!stop_requested)
+    {
+        int conn = accept(fd, NULL, NULL);
+        if (conn < 0)
+        {
+            if (errno == EINTR) continue;
+            perror("ERROR: accept");
+            break;
+        }
+        FILE* in = fdopen(dup(conn), "r");
+        FILE* out = fdopen(conn, "w");
+        if (in == NULL || out == NULL)
+        {
+            perror("ERROR: fdopen");
+            if (in != NULL) fclose(in);
+            if (out != NULL) fclose(out);
+            else close(conn);
+            continue;
+        }
+        run_pipeline(in, out, workers, capacity, ordered);
+        fclose(in);
+        fclose(out);
+    }
+
+    close(fd);
+    unlink(path);
+    return 0;
+}
+#endif
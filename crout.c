@@ -1,6 +1,7 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <math.h>
-//#include <string.h>
+#include <string.h>
 #ifdef PRINTDEBUG
 #include <stdarg.h>
 #endif
@@ -11,6 +12,18 @@ void backward_substitution(int n, double U[][n], double x[n], double y[n]);
 
 void matmul(int n, double A[][n], double B[][n], double C[][n]);
 void matmul_general(int m, int n, int p, double A[][n], double B[][p], double C[][p]);
+void matmul_strassen(int m, int n, int p, double A[][n], double B[][p], double C[][p], int crossover, double* work);
+size_t strassen_workspace_size(int m, int n, int p, int crossover);
+
+// Strassen-Winograd: with -DSTRASSEN, matmul() and matmul_general() switch to
+// matmul_strassen() once every dimension is at least STRASSEN_MIN_N
+#ifndef STRASSEN_MIN_N
+#define STRASSEN_MIN_N 2048
+#endif
+#ifndef STRASSEN_CROSSOVER
+#define STRASSEN_CROSSOVER 128  // below this the blocked kernel is faster (see measurematmul.c)
+#endif
+#define KERNEL_BLOCK 64
 
 #ifndef HIDEDUP
 double round_to_digits(double value, int digits);
@@ -22,9 +35,19 @@ extern double round_to_digits(double value, int digits);
 extern void print_matrix(int m, int n, double A[][n]);
 #endif
 static void debug_message(const char* message, ...);
+static void strassen(int m, int n, int p, int lda, double A[][lda], int ldb, double B[][ldb], int ldc, double C[][ldc], int crossover, double* work);
+static void gemm_blocked(int m, int n, int p, int lda, double A[][lda], int ldb, double B[][ldb], int ldc, double C[][ldc]);
+static void add(int m, int n, int ldx, double X[][ldx], double sign, int ldy, double Y[][ldy], int ldz, double Z[][ldz]);
 
 void matmul_general(int m, int n, int p, double A[][n], double B[][p], double C[][p])
 {
+#ifdef STRASSEN
+    if (m >= STRASSEN_MIN_N && n >= STRASSEN_MIN_N && p >= STRASSEN_MIN_N)
+    {
+        matmul_strassen(m, n, p, A, B, C, STRASSEN_CROSSOVER, NULL);
+        return;
+    }
+#endif
     for (int i = 0; i < m; i++)
     {
         for (int j = 0; j < p; j++)
@@ -158,6 +181,13 @@ void decompose(int n, double A[][n], double L[][n], double U[][n], int precision
 
 void matmul(int n, double A[][n], double B[][n], double C[][n])
 {
+#ifdef STRASSEN
+    if (n >= STRASSEN_MIN_N)
+    {
+        matmul_strassen(n, n, n, A, B, C, STRASSEN_CROSSOVER, NULL);
+        return;
+    }
+#endif
     for (int i = 0; i < n; i++)
     {
         for (int j = 0; j < n; j++)
@@ -170,6 +200,181 @@ void matmul(int n, double A[][n], double B[][n], double C[][n])
     }
 }
 
+/**
+ * C += A * B with A m x n and B n x p, by the Strassen-Winograd recursion:
+ * 7 half-size products and 15 additions per level instead of 8 products.
+ * Blocks with a dimension at or below crossover are multiplied by a blocked
+ * kernel, and odd rows or columns are peeled off and added separately.
+ * work must hold strassen_workspace_size(m, n, p, crossover) doubles; with
+ * NULL it is allocated here once. The recursion itself does not allocate.
+ */
+void matmul_strassen(int m, int n, int p, double A[][n], double B[][p], double C[][p], int crossover, double* work)
+{
+    double* allocated = NULL;
+    if (work == NULL)
+    {
+        size_t size = strassen_workspace_size(m, n, p, crossover);
+        work = allocated = malloc(sizeof(double) * (size > 0 ? size : 1));
+    }
+
+    strassen(m, n, p, n, A, p, B, p, C, crossover, work);
+
+    free(allocated);
+}
+
+/**
+ * Doubles of workspace needed by matmul_strassen(): the S, T, P and Q blocks
+ * of every level, each level a quarter of the one above.
+ */
+size_t strassen_workspace_size(int m, int n, int p, int crossover)
+{
+    if (crossover < 1) crossover = 1;
+    if (m <= crossover || n <= crossover || p <= crossover) return 0;
+
+    size_t h = m / 2, k = n / 2, w = p / 2;
+    return h * k + k * w + 2 * h * w + strassen_workspace_size(h, k, w, crossover);
+}
+
+// a quadrant (or a peeled row or column) of a strassen() operand is addressed in
+// place: its first element is X[r][c] and its rows are still ld apart
+#define BLOCK_AT(X, ld, r, c) ((double (*)[ld])&(X)[r][c])
+
+static void strassen(int m, int n, int p, int lda, double A[][lda], int ldb, double B[][ldb], int ldc, double C[][ldc], int crossover, double* work)
+{
+    if (crossover < 1) crossover = 1;
+    if (m <= crossover || n <= crossover || p <= crossover)
+    {
+        gemm_blocked(m, n, p, lda, A, ldb, B, ldc, C);
+        return;
+    }
+
+    int h = m / 2, k = n / 2, w = p / 2;
+    double (*A11)[lda] = A, (*A12)[lda] = BLOCK_AT(A, lda, 0, k);
+    double (*A21)[lda] = BLOCK_AT(A, lda, h, 0), (*A22)[lda] = BLOCK_AT(A, lda, h, k);
+    double (*B11)[ldb] = B, (*B12)[ldb] = BLOCK_AT(B, ldb, 0, w);
+    double (*B21)[ldb] = BLOCK_AT(B, ldb, k, 0), (*B22)[ldb] = BLOCK_AT(B, ldb, k, w);
+    double (*C11)[ldc] = C, (*C12)[ldc] = BLOCK_AT(C, ldc, 0, w);
+    double (*C21)[ldc] = BLOCK_AT(C, ldc, h, 0), (*C22)[ldc] = BLOCK_AT(C, ldc, h, w);
+
+    double (*S)[k] = (double (*)[k])work;
+    double (*T)[w] = (double (*)[w])(work + (size_t)h * k);
+    double (*P)[w] = (double (*)[w])(work + (size_t)h * k + (size_t)k * w);
+    double (*Q)[w] = (double (*)[w])(work + (size_t)h * k + (size_t)k * w + (size_t)h * w);
+    double* child = work + (size_t)h * k + (size_t)k * w + 2 * (size_t)h * w;
+
+    // P = M1 = A11 B11, C11 += M1 + M2
+    memset(P, 0, sizeof(double) * h * w);
+    strassen(h, k, w, lda, A11, ldb, B11, w, P, crossover, child);
+    add(h, w, ldc, C11, 1, w, P, ldc, C11);
+    strassen(h, k, w, lda, A12, ldb, B21, ldc, C11, crossover, child);
+
+    // Q = M5 = (A21 + A22)(B12 - B11)
+    add(h, k, lda, A21, 1, lda, A22, k, S);
+    add(k, w, ldb, B12, -1, ldb, B11, w, T);
+    memset(Q, 0, sizeof(double) * h * w);
+    strassen(h, k, w, k, S, w, T, w, Q, crossover, child);
+
+    // P = M1 + M6 with S2 = S1 - A11, T2 = B22 - T1
+    add(h, k, k, S, -1, lda, A11, k, S);
+    add(k, w, ldb, B22, -1, w, T, w, T);
+    strassen(h, k, w, k, S, w, T, w, P, crossover, child);
+
+    // C12 += M3 + (M1 + M6) + M5 with S4 = A12 - S2
+    add(h, k, lda, A12, -1, k, S, k, S);
+    strassen(h, k, w, k, S, ldb, B22, ldc, C12, crossover, child);
+    add(h, w, ldc, C12, 1, w, P, ldc, C12);
+    add(h, w, ldc, C12, 1, w, Q, ldc, C12);
+
+    // C21 -= M4 = A22 T4, with -T4 = B21 - T2
+    add(k, w, ldb, B21, -1, w, T, w, T);
+    strassen(h, k, w, lda, A22, w, T, ldc, C21, crossover, child);
+
+    // P = M1 + M6 + M7 with S3 = A11 - A21, T3 = B22 - B12
+    add(h, k, lda, A11, -1, lda, A21, k, S);
+    add(k, w, ldb, B22, -1, ldb, B12, w, T);
+    strassen(h, k, w, k, S, w, T, w, P, crossover, child);
+    add(h, w, ldc, C21, 1, w, P, ldc, C21);
+    add(h, w, ldc, C22, 1, w, P, ldc, C22);
+    add(h, w, ldc, C22, 1, w, Q, ldc, C22);
+
+    // peel the odd row, column and inner dimension
+    if (n > 2 * k)
+    {
+        gemm_blocked(2 * h, 1, 2 * w, lda, BLOCK_AT(A, lda, 0, n - 1), ldb, BLOCK_AT(B, ldb, n - 1, 0), ldc, C);
+    }
+    if (p > 2 * w)
+    {
+        gemm_blocked(m, n, 1, lda, A, ldb, BLOCK_AT(B, ldb, 0, p - 1), ldc, BLOCK_AT(C, ldc, 0, p - 1));
+    }
+    if (m > 2 * h)
+    {
+        gemm_blocked(1, n, 2 * w, lda, BLOCK_AT(A, lda, m - 1, 0), ldb, B, ldc, BLOCK_AT(C, ldc, m - 1, 0));
+    }
+}
+
+#undef BLOCK_AT
+
+/**
+ * C += A * B blocked for the cache, four rows of C at a time so that every
+ * element of B loaded is used four times; the j loops vectorize.
+ */
+static void gemm_blocked(int m, int n, int p, int lda, double A[][lda], int ldb, double B[][ldb], int ldc, double C[][ldc])
+{
+    for (int k0 = 0; k0 < n; k0 += KERNEL_BLOCK)
+    {
+        int k1 = (k0 + KERNEL_BLOCK < n) ? k0 + KERNEL_BLOCK : n;
+        for (int j0 = 0; j0 < p; j0 += 4 * KERNEL_BLOCK)
+        {
+            int j1 = (j0 + 4 * KERNEL_BLOCK < p) ? j0 + 4 * KERNEL_BLOCK : p;
+            int i = 0;
+            for (; i + 4 <= m; i += 4)
+            {
+                double* restrict c0 = C[i];
+                double* restrict c1 = C[i + 1];
+                double* restrict c2 = C[i + 2];
+                double* restrict c3 = C[i + 3];
+                for (int k = k0; k < k1; k++)
+                {
+                    double a0 = A[i][k], a1 = A[i + 1][k], a2 = A[i + 2][k], a3 = A[i + 3][k];
+                    const double* restrict b = B[k];
+                    for (int j = j0; j < j1; j++)
+                    {
+                        c0[j] += a0 * b[j];
+                        c1[j] += a1 * b[j];
+                        c2[j] += a2 * b[j];
+                        c3[j] += a3 * b[j];
+                    }
+                }
+            }
+            for (; i < m; i++)
+            {
+                for (int k = k0; k < k1; k++)
+                {
+                    double a = A[i][k];
+                    for (int j = j0; j < j1; j++)
+                    {
+                        C[i][j] += a * B[k][j];
+                    }
+                }
+            }
+        }
+    }
+}
+
+/**
+ * Z = X + sign * Y for m x n blocks; Z may be X or Y.
+ */
+static void add(int m, int n, int ldx, double X[][ldx], double sign, int ldy, double Y[][ldy], int ldz, double Z[][ldz])
+{
+    for (int i = 0; i < m; i++)
+    {
+        for (int j = 0; j < n; j++)
+        {
+            Z[i][j] = X[i][j] + sign * Y[i][j];
+        }
+    }
+}
+
 #ifndef NOMAIN
 int main()
 {
@@ -20,13 +20,19 @@ recipe:
 
 int gauss_elim(int m, int n, double A[][n], double* x, bool do_partial_pivoting, bool augmented_matrix, int precision);
 int eliminate(int m, int n, double A[][n], bool do_partial_pivoting, bool augmented_matrix, int precision);
+int eliminate_counting_swaps(int m, int n, double A[][n], bool do_partial_pivoting, bool augmented_matrix, int precision, int* swaps);
+int eliminate_recording(int m, int n, double A[][n], bool do_partial_pivoting, bool augmented_matrix, int precision, int* swaps,
+    int* op_row, int* op_pivot, double* op_multiplier, int* num_ops);
 int substitute(int m, int n, double A[][n], double* x, int precision);
 double round_to_digits(double value, int digits);
 
+static int eliminate_rows(int m, int n, double A[][n], bool do_partial_pivoting, bool augmented_matrix, int precision, int* swaps, int* first, int* last,
+    int* op_row, int* op_pivot, double* op_multiplier, int* num_ops);
+static int substitute_rows(int m, int n, double A[][n], double* x, int precision, const int* first, const int* last);
 static int find_row_index_with_max_pivot(int m, int n, double A[][n], int i, int k);
-static void row_swap(int n, double A[][n], int i, int j);
+static void row_swap(int n, double A[][n], int i, int j, int* first, int* last);
 static void swap_element(int n, double A[][n], int i, int j, int c);
-static bool row_is_all_zeros(int n, double A[][n], int row, int last_index);
+static void find_row_extent(int n, double A[][n], int row, int from, int to, int* first, int* last);
 
 static void debug_matrix_with_pivot_info(int m, int n, double A[][n], int pivot_index, const char* heading);
 static void debug_matrix(int m, int n, double A[][n]);
@@ -140,6 +146,118 @@ void test_3()
     assert(fabs(x[2] - 11.6471) <= EPSILON);
 
 }
+
+void test_4()
+{
+    // banded system, most of every row is zero
+    int n = 40;
+    double A[n][n + 1];
+    double x[n];
+    memset(A, 0, sizeof(A));
+    for (int i = 0; i < n; i++)
+    {
+        A[i][i] = 4;
+        if (i > 0) A[i][i - 1] = -1;
+        if (i + 1 < n) A[i][i + 1] = -2;
+        A[i][n] = 4 - (i > 0) - 2 * (i + 1 < n);    // x = 1
+    }
+    int ret = gauss_elim(n, n + 1, A, x, true, true, 15);
+
+    assert(ret == 0);
+    for (int i = 0; i < n; i++)
+    {
+        assert(fabs(x[i] - 1) <= EPSILON);
+    }
+
+    /* zero rows: dependent, and inconsistent */
+    double matrix_B[][3] = {
+        { 1, 1, 2 },
+        { 2, 2, 4 }
+    };
+    ret = gauss_elim(2, 3, matrix_B, x, true, true, 10);
+
+    assert(ret == 0);
+    assert(fabs(x[0] - 1) <= EPSILON);
+    assert(fabs(x[1] - 1) <= EPSILON);
+
+    double matrix_C[][3] = {
+        { 1, 1, 2 },
+        { 2, 2, 7 }
+    };
+    ret = gauss_elim(2, 3, matrix_C, x, true, true, 10);
+
+    assert(ret == -2);
+}
+
+/**
+ * eliminate() as it was before the row extents: every update covers the whole row.
+ */
+static void eliminate_full_rows(int m, int n, double A[][n], bool do_partial_pivoting, int precision)
+{
+    int numPivots = (m > n - 1) ? n - 1 : (m - 1);
+    for (int k = 0; k < numPivots; k++)
+    {
+        double pivot = A[k][k];
+        if (do_partial_pivoting == true && pivot == 0)
+        {
+            int r = find_row_index_with_max_pivot(m, n, A, k, k);
+            if (r != k)
+            {
+                for (int col = 0; col < n; col++) swap_element(n, A, k, r, col);
+                pivot = A[k][k];
+            }
+        }
+        for (int i = k + 1; i < m; i++)
+        {
+            if (do_partial_pivoting == true && fabs(pivot) < fabs(A[i][k]))
+            {
+                for (int col = 0; col < n; col++) swap_element(n, A, k, i, col);
+                pivot = A[k][k];
+            }
+            if (A[i][k] == 0) continue;
+            double multiplier = round_to_digits(A[i][k] / pivot, precision);
+            A[i][k] = 0;
+            for (int j = k + 1; j < n; j++)
+            {
+                A[i][j] -= round_to_digits(A[k][j] * multiplier, precision);
+                A[i][j] = round_to_digits(A[i][j], precision);
+            }
+        }
+    }
+}
+
+void test_5()
+{
+    // unrounded inputs with a third of zeros and trailing zero runs give exactly
+    // the same result as the full row updates
+    srand(5);
+    for (int t = 0; t < 400; t++)
+    {
+        int n = 2 + rand() % 12;
+        int precision = 2 + t % 6;
+        bool pivoting = (t % 2 == 0);
+        double A[n][n + 1], R[n][n + 1];
+        for (int i = 0; i < n; i++)
+        {
+            int tail = rand() % n;    // last coefficient column of the row
+            for (int j = 0; j <= n; j++)
+            {
+                bool zero = (j < n && j > tail) || rand() % 3 == 0;
+                A[i][j] = R[i][j] = zero ? 0 : (double)rand() / RAND_MAX * 20 - 10;
+            }
+        }
+
+        eliminate(n, n + 1, A, pivoting, true, precision);
+        eliminate_full_rows(n, n + 1, R, pivoting, precision);
+        for (int i = 0; i < n; i++)
+        {
+            for (int j = 0; j <= n; j++)
+            {
+                assert(A[i][j] == R[i][j] || (isnan(A[i][j]) && isnan(R[i][j])));
+            }
+        }
+    }
+}
 #endif
 
 #ifndef NOMAIN
@@ -152,6 +270,8 @@ int main(int argc, char** argv)
     test_1();
     test_2();
     test_3();
+    test_4();
+    test_5();
     printf("Finished running tests\n");
 
     return 0;
@@ -235,17 +355,75 @@ int gauss_elim(int m, int n, double A[][n], double* x, bool do_partial_pivoting,
     /** Dump for debugging **/
     debug_matrix(m, n, A);
 
-    /** forward elimination **/
-    int ret = eliminate(m, n, A, do_partial_pivoting, augmented_matrix, precision);
+    /** forward elimination, keeping the nonzero extent of every row **/
+    int first[m], last[m];
+    int ret = eliminate_rows(m, n, A, do_partial_pivoting, augmented_matrix, precision, NULL, first, last, NULL, NULL, NULL, NULL);
 
     /** back substitution **/
-    if (augmented_matrix) ret |= substitute(m, n, A, x, precision);
+    if (augmented_matrix) ret |= substitute_rows(m, n, A, x, precision, first, last);
 
     return ret;
 }
 
 int eliminate(int m, int n, double A[][n], bool do_partial_pivoting, bool augmented_matrix, int precision)
 {
+    return eliminate_counting_swaps(m, n, A, do_partial_pivoting, augmented_matrix, precision, NULL);
+}
+
+/**
+ * Same as eliminate(), and also stores the number of row interchanges in *swaps
+ * (if not NULL), which gives the sign of the determinant.
+ */
+int eliminate_counting_swaps(int m, int n, double A[][n], bool do_partial_pivoting, bool augmented_matrix, int precision, int* swaps)
+{
+    int first[m], last[m];
+    return eliminate_rows(m, n, A, do_partial_pivoting, augmented_matrix, precision, swaps, first, last, NULL, NULL, NULL, NULL);
+}
+
+/**
+ * Same as eliminate_counting_swaps(), and also records the row operations in
+ * the order they were done, so that they can be replayed on other columns
+ * (e.g. right hand sides) without eliminating again. Operation p is
+ *     row op_row[p] -= op_multiplier[p] * row op_pivot[p]     if op_row[p] >= 0
+ *     interchange of rows op_pivot[p] and -1 - op_row[p]       if op_row[p] < 0
+ * The arrays must hold m * m operations; *num_ops is set to their number.
+ */
+int eliminate_recording(int m, int n, double A[][n], bool do_partial_pivoting, bool augmented_matrix, int precision, int* swaps,
+    int* op_row, int* op_pivot, double* op_multiplier, int* num_ops)
+{
+    int first[m], last[m];
+    return eliminate_rows(m, n, A, do_partial_pivoting, augmented_matrix, precision, swaps, first, last,
+        op_row, op_pivot, op_multiplier, num_ops);
+}
+
+int substitute(int m, int n, double A[][n], double* x, int precision)
+{
+    int first[m], last[m];
+    for (int i = 0; i < m; i++)
+    {
+        find_row_extent(n, A, i, 0, n - 1, &first[i], &last[i]);
+    }
+    return substitute_rows(m, n, A, x, precision, first, last);
+}
+
+/**
+ * Forward elimination that also maintains the nonzero extent of every row:
+ * A[i][j] is zero for j < first[i] and j > last[i], and first[i] = n,
+ * last[i] = -1 for a zero row. The extents are exact (leading and trailing
+ * zeros left by cancellation are trimmed), so the updates only cover the
+ * pivot row's extent, rows without an entry in the pivot column are skipped
+ * without reading them and substitute_rows() spots zero rows in O(1).
+ */
+static int eliminate_rows(int m, int n, double A[][n], bool do_partial_pivoting, bool augmented_matrix, int precision, int* swaps, int* first, int* last,
+    int* op_row, int* op_pivot, double* op_multiplier, int* num_ops)
+{
+    if (swaps != NULL) *swaps = 0;
+    int ops = 0;
+    for (int i = 0; i < m; i++)
+    {
+        find_row_extent(n, A, i, 0, n - 1, &first[i], &last[i]);
+    }
+
     int numCoeffCols = augmented_matrix ? n - 1 : n;
     int numPivots = (m > numCoeffCols) ? numCoeffCols : (m - 1);
     for (int k = 0; k < numPivots; k++)
@@ -257,19 +435,37 @@ int eliminate(int m, int n, double A[][n], bool do_partial_pivoting, bool augmen
         {
             // interchange A[i] with A[r] where A[r][k] is max
             int r = find_row_index_with_max_pivot(m, n, A, k, k);
-            row_swap(n, A, k, r);
-            pivot = A[k][k];    // update the pivot because we have swapped
+            if (r != k)     // row_swap() of a row with itself would zero it
+            {
+                row_swap(n, A, k, r, first, last);
+                pivot = A[k][k];    // update the pivot because we have swapped
+                if (swaps != NULL) (*swaps)++;
+                if (op_row != NULL)
+                {
+                    op_row[ops] = -1 - r;
+                    op_pivot[ops++] = k;
+                }
+            }
 
             debug_matrix_with_pivot_info(m, n, A, k, "div0");
         }
 
         for (int i = k + 1; i < m; i++) // for all rows below the pivot row Rp
         {
+            // A[i][k] is zero: no swap and nothing to eliminate, and the column isn't read
+            if (first[i] > k) continue;
+
             // b. round-off error
             if (do_partial_pivoting == true && fabs(pivot) < fabs(A[i][k]))
             {
-                row_swap(n, A, k, i);
+                row_swap(n, A, k, i, first, last);
                 pivot = A[k][k];    // update the pivot because we have swapped
+                if (swaps != NULL) (*swaps)++;
+                if (op_row != NULL)
+                {
+                    op_row[ops] = -1 - i;
+                    op_pivot[ops++] = k;
+                }
 
                 debug_matrix_with_pivot_info(m, n, A, k, "round-off");
             }
@@ -278,22 +474,42 @@ int eliminate(int m, int n, double A[][n], bool do_partial_pivoting, bool augmen
 
             // 2. eliminate
             double multiplier = round_to_digits(A[i][k] / pivot, precision);    // division operation
+            if (op_row != NULL)
+            {
+                op_row[ops] = i;
+                op_pivot[ops] = k;
+                op_multiplier[ops++] = multiplier;
+            }
 
+            // columns past the pivot row's extent only subtract zero, unless a zero
+            // pivot made the multiplier inf and 0 * inf spreads NaNs over the row
+            int end = isfinite(multiplier) ? last[k] : n - 1;
             A[i][k] = 0;    // set A[i][k] to zero directly
-            for (int j = k + 1; j < n; j++) // rest of the columns
+            for (int j = k + 1; j <= end; j++) // rest of the columns
             {
                 A[i][j] -= round_to_digits(A[k][j] * multiplier, precision);    // subtraction and multiplication operations
                 A[i][j] = round_to_digits(A[i][j], precision);
             }
+            // but they are still rounded, as when the loop covered the whole row
+            for (int j = (end > k) ? end + 1 : k + 1; j <= last[i]; j++)
+            {
+                A[i][j] = round_to_digits(A[i][j], precision);
+            }
+            find_row_extent(n, A, i, k + 1, (last[i] > end) ? last[i] : end, &first[i], &last[i]);
         }
 
         debug_matrix_with_pivot_info(m, n, A, k, "elim");
     }
 
+    if (num_ops != NULL) *num_ops = ops;
     return 0;
 }
 
-int substitute(int m, int n, double A[][n], double* x, int precision)
+/**
+ * Back substitution over the nonzero extents from eliminate_rows(); a row is
+ * all zeros, apart from b, when its extent starts at the last column.
+ */
+static int substitute_rows(int m, int n, double A[][n], double* x, int precision, const int* first, const int* last)
 {
     bool x_solved[n];
     memset(x_solved, false, n);
@@ -301,7 +517,7 @@ int substitute(int m, int n, double A[][n], double* x, int precision)
     for (int i = m - 1; i >= 0; i--)
     {
         double b = A[i][n - 1];
-        if (row_is_all_zeros(n, A, i, n - 1))
+        if (first[i] >= n - 1)
         {
             if ((int)b == 0)
             {
@@ -314,9 +530,10 @@ int substitute(int m, int n, double A[][n], double* x, int precision)
             }
         }
 
-        char unsolved_index = -1;
+        int unsolved_index = -1;
+        int end = (last[i] < n - 1) ? last[i] : n - 2;
         // verify that the row is solved
-        for (int j = 0; j < n - 1; j++)
+        for (int j = first[i]; j <= end; j++)
         {
             if (A[i][j] != 0)
             {
@@ -381,14 +598,23 @@ static int find_row_index_with_max_pivot(int m, int n, double A[][n], int i, int
 }
 
 /**
- * Swaps rows i and j
+ * Swaps rows i and j, and their extents; only the columns inside either extent are touched
  */
-static void row_swap(int n, double A[][n], int i, int j)
+static void row_swap(int n, double A[][n], int i, int j, int* first, int* last)
 {
-    for (int col = 0; col < n; col++)
+    int from = (first[i] < first[j]) ? first[i] : first[j];
+    int to = (last[i] > last[j]) ? last[i] : last[j];
+    for (int col = from; col <= to; col++)
     {
         swap_element(n, A, i, j, col);
     }
+
+    int t = first[i];
+    first[i] = first[j];
+    first[j] = t;
+    t = last[i];
+    last[i] = last[j];
+    last[j] = t;
 }
 
 static void swap_element(int n, double A[][n], int i, int j, int c)
@@ -398,18 +624,16 @@ static void swap_element(int n, double A[][n], int i, int j, int c)
     A[i][c] = A[i][c] - A[j][c];
 }
 
-static bool row_is_all_zeros(int n, double A[][n], int row, int last_index)
+/**
+ * Finds the first and last nonzero columns of the row within from..to, the rest
+ * of the row being known to be zero. Returns first = n and last = -1 for a zero row.
+ */
+static void find_row_extent(int n, double A[][n], int row, int from, int to, int* first, int* last)
 {
-    bool zeros = true;
-    for (int j = 0; j < last_index; j++)
-    {
-        if (A[row][j] != 0)
-        {
-            zeros = false;
-            break;
-        }
-    }
-    return zeros;
+    while (from <= to && A[row][from] == 0) from++;
+    while (to >= from && A[row][to] == 0) to--;
+    *first = (from <= to) ? from : n;
+    *last = (from <= to) ? to : -1;
 }
 
 static void debug_matrix_with_pivot_info(int m, int n, double A[][n], int pivot_index, const char* heading)
@@ -0,0 +1,952 @@
+// vim: noai:ts=4:sw=4
+
+/*
+recipe:
+> `gcc --std=c99 -O3 -march=native -fopenmp -DNOMAIN gausselim.c krylov.c -o krylov -lm`
+> run: `./krylov [--history <file>] [--max-k <k>] [--max-dense-n <n>] [--deterministic] [--threads <p>]`
+> define TEST macro for running tests: `gcc --std=c99 -fopenmp -DNOMAIN -DTEST gausselim.c krylov.c -o krylov -lm`
+
+Preconditioned Krylov solvers for sparse systems stored in CSR format:
+conjugate gradients for SPD matrices, restarted GMRES(m) and BiCGSTAB for
+general ones. The sparse matrix-vector product and the vector kernels are
+OpenMP threaded and written for the compiler to vectorize.
+The ILU(0) and ILUT preconditioners follow the row by row Crout scheme of
+decompose() in crout.c (L carries the diagonal, U has a unit diagonal), with
+the sums restricted to the sparsity pattern, or to the entries that survive
+the drop rules.
+
+main() solves 2D Poisson and convection-diffusion problems of growing size
+with every solver, and with gauss_elim() up to --max-dense-n unknowns, and
+prints the timings as CSV. A solve that hits the iteration limit or breaks
+down is written with converged = 0; its time is no result to compare against.
+
+The dot products are the only reductions across threads. With
+--deterministic they are summed in chunks of DOT_CHUNK elements with a
+fixed order inside each chunk and a fixed pairwise tree over the chunks, so
+the iterates are bit-identical for any number of threads. main() ends with
+the cost of that against the OpenMP reduction.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <math.h>
+#include <omp.h>
+#ifdef TEST
+#include <assert.h>
+#endif
+
+extern int gauss_elim(int m, int n, double A[][n], double* x, bool do_partial_pivoting, bool augmented_matrix, int precision);
+
+/** compressed sparse row matrix, columns sorted within each row **/
+struct csr_matrix
+{
+    int n;
+    int nnz;
+    int* row_ptr;   // n + 1
+    int* col;       // nnz
+    double* val;    // nnz
+};
+
+/** entry of a sparse row while it is being built **/
+struct sparse_entry
+{
+    double value;
+    int col;
+};
+
+enum precond_kind { PRECOND_NONE, PRECOND_ILU0, PRECOND_ILUT };
+
+/** incomplete factorization M = L*U stored in one CSR matrix, like decompose()'s L and U side by side **/
+struct preconditioner
+{
+    enum precond_kind kind;
+    struct csr_matrix F;
+    int* diag;      // position of the diagonal entry of each row of F
+};
+
+/** outcome of a solve; the history of every iteration goes to the monitor file **/
+struct krylov_stats
+{
+    int iterations;
+    double residual;    // ||b - A x|| / ||b||
+    double seconds;
+    bool converged;
+};
+
+void csr_free(struct csr_matrix* A);
+void spmv(const struct csr_matrix* A, const double* x, double* y);
+
+int precond_setup(struct preconditioner* M, const struct csr_matrix* A, enum precond_kind kind, double drop_tol, int fill);
+void precond_apply(const struct preconditioner* M, const double* r, double* z);
+void precond_free(struct preconditioner* M);
+
+struct krylov_stats cg(const struct csr_matrix* A, const struct preconditioner* M, const double* b, double* x,
+    double tol, int max_iter, FILE* monitor);
+struct krylov_stats gmres(const struct csr_matrix* A, const struct preconditioner* M, const double* b, double* x,
+    int restart, double tol, int max_iter, FILE* monitor);
+struct krylov_stats bicgstab(const struct csr_matrix* A, const struct preconditioner* M, const double* b, double* x,
+    double tol, int max_iter, FILE* monitor);
+
+void convection_diffusion_2d(struct csr_matrix* A, int k, double convection);
+
+static double dot(int n, const double* x, const double* y);
+static double dot_reproducible(int n, const double* x, const double* y);
+static double norm2(int n, const double* x);
+static void axpy(int n, double alpha, const double* x, double* y);
+static void residual(const struct csr_matrix* A, const double* b, const double* x, double* r);
+static void report(FILE* monitor, int iteration, double residual, double start);
+static int compare_magnitude(const void* a, const void* b);
+static int compare_column(const void* a, const void* b);
+
+#define DOT_CHUNK 4096      // elements per partial sum of dot_reproducible()
+static bool deterministic_sums = false;
+
+#ifdef TEST
+#define EPSILON 1e-6
+static void test_1()
+{
+    // every solver and preconditioner agrees with gauss_elim() on a small Poisson problem
+    int k = 6, n = k * k;
+    struct csr_matrix A;
+    convection_diffusion_2d(&A, k, 0.0);
+    double b[n], x[n], x_ref[n], D[n][n + 1];
+    memset(D, 0, sizeof(D));
+    for (int i = 0; i < n; i++)
+    {
+        b[i] = D[i][n] = i % 7 - 3;
+        for (int p = A.row_ptr[i]; p < A.row_ptr[i + 1]; p++)
+        {
+            D[i][A.col[p]] = A.val[p];
+        }
+    }
+    assert(gauss_elim(n, n + 1, D, x_ref, true, true, 15) == 0);
+
+    enum precond_kind kinds[] = { PRECOND_NONE, PRECOND_ILU0, PRECOND_ILUT };
+    for (int p = 0; p < 3; p++)
+    {
+        struct preconditioner M;
+        assert(precond_setup(&M, &A, kinds[p], 1e-3, 10) == 0);
+        // ILUT drops asymmetrically, so it is no preconditioner for CG
+        for (int s = kinds[p] == PRECOND_ILUT ? 1 : 0; s < 3; s++)
+        {
+            memset(x, 0, sizeof(x));
+            struct krylov_stats st = s == 0 ? cg(&A, &M, b, x, 1e-12, 500, NULL)
+                : s == 1 ? gmres(&A, &M, b, x, 20, 1e-12, 500, NULL)
+                : bicgstab(&A, &M, b, x, 1e-12, 500, NULL);
+            assert(st.converged);
+            for (int i = 0; i < n; i++) assert(fabs(x[i] - x_ref[i]) <= EPSILON);
+        }
+        precond_free(&M);
+    }
+    csr_free(&A);
+}
+#endif
+
+int main(int argc, char** argv)
+{
+#ifdef TEST
+    printf("Running tests\n");
+    test_1();
+    printf("Finished running tests\n");
+
+    return 0;
+#else
+    /** input: parse command line arguments **/
+    FILE* history = NULL;
+    int max_k = 400;
+    int max_dense_n = 6400;     // 80x80 grid: a 330 MB dense matrix, about 6 s for gauss_elim()
+    for (int arg_i = 1; arg_i < argc; arg_i++)
+    {
+        if (strcmp(argv[arg_i], "--history") == 0 && arg_i + 1 < argc)
+        {
+            history = fopen(argv[++arg_i], "w");
+            if (history == NULL)
+            {
+                printf("ERROR: cannot open %s for writing\n", argv[arg_i]);
+                return -1;
+            }
+            fprintf(history, "iteration,residual,elapsed_ms\n");
+        }
+        else if (strcmp(argv[arg_i], "--max-k") == 0 && arg_i + 1 < argc)
+        {
+            max_k = atoi(argv[++arg_i]);
+        }
+        else if (strcmp(argv[arg_i], "--max-dense-n") == 0 && arg_i + 1 < argc)
+        {
+            max_dense_n = atoi(argv[++arg_i]);
+        }
+        else if (strcmp(argv[arg_i], "--deterministic") == 0)
+        {
+            deterministic_sums = true;
+        }
+        else if (strcmp(argv[arg_i], "--threads") == 0 && arg_i + 1 < argc)
+        {
+            omp_set_num_threads(atoi(argv[++arg_i]));
+        }
+        else
+        {
+            printf("WARNING: unrecognized option %s\n", argv[arg_i]);
+        }
+    }
+
+    const char* precond_names[] = { "none", "ilu0", "ilut" };
+    printf("problem,n,method,precond,converged,iterations,residual,setup_ms,solve_ms,max_error\n");
+    for (int k = 10; k <= max_k; k *= 2)
+    {
+        int n = k * k;
+        for (int problem = 0; problem < 2; problem++)
+        {
+            // x = ones, b = A x
+            struct csr_matrix A;
+            convection_diffusion_2d(&A, k, problem == 0 ? 0.0 : 0.5);
+            const char* problem_name = problem == 0 ? "poisson" : "convdiff";
+            double* ones = malloc(sizeof(double) * n);
+            double* b = malloc(sizeof(double) * n);
+            double* x = malloc(sizeof(double) * n);
+            for (int i = 0; i < n; i++) ones[i] = 1.0;
+            spmv(&A, ones, b);
+
+            for (int p = 0; p < 3; p++)
+            {
+                struct preconditioner M;
+                double start = omp_get_wtime();
+                if (precond_setup(&M, &A, (enum precond_kind)p, 1e-3, 10) != 0)
+                {
+                    printf("ERROR: %s preconditioner broke down\n", precond_names[p]);
+                    continue;
+                }
+                double setup_ms = (omp_get_wtime() - start) * 1e3;
+
+                // CG only for the SPD problem and a symmetric preconditioner
+                for (int s = (problem == 1 || p == PRECOND_ILUT) ? 1 : 0; s < 3; s++)
+                {
+                    const char* method = s == 0 ? "cg" : s == 1 ? "gmres" : "bicgstab";
+                    if (history != NULL)
+                        fprintf(history, "# %s n=%d %s %s\n", problem_name, n, method, precond_names[p]);
+                    memset(x, 0, sizeof(double) * n);
+                    struct krylov_stats st = s == 0 ? cg(&A, &M, b, x, 1e-10, 10 * n, history)
+                        : s == 1 ? gmres(&A, &M, b, x, 30, 1e-10, 10 * n, history)
+                        : bicgstab(&A, &M, b, x, 1e-10, 10 * n, history);
+
+                    double max_error = 0;
+                    for (int i = 0; i < n; i++) max_error = fmax(max_error, fabs(x[i] - 1.0));
+                    printf("%s,%d,%s,%s,%d,%d,%.3e,%.3f,%.3f,%.3e\n", problem_name, n, method, precond_names[p],
+                        st.converged, st.iterations, st.residual, setup_ms, st.seconds * 1e3, max_error);
+                    fflush(stdout);
+                }
+                precond_free(&M);
+            }
+
+            if (n <= max_dense_n)
+            {
+                double (*D)[n + 1] = calloc((size_t)n * (n + 1), sizeof(double));
+                for (int i = 0; i < n; i++)
+                {
+                    for (int q = A.row_ptr[i]; q < A.row_ptr[i + 1]; q++)
+                    {
+                        D[i][A.col[q]] = A.val[q];
+                    }
+                    D[i][n] = b[i];
+                }
+                double start = omp_get_wtime();
+                int ret = gauss_elim(n, n + 1, D, x, true, true, 15);
+                double solve_ms = (omp_get_wtime() - start) * 1e3;
+                double max_error = 0;
+                for (int i = 0; i < n; i++) max_error = fmax(max_error, fabs(x[i] - 1.0));
+                if (ret != 0) printf("ERROR: gauss_elim() returned %d\n", ret);
+                printf("%s,%d,gauss_elim,-,%d,-,-,0,%.3f,%.3e\n", problem_name, n, ret == 0, solve_ms, max_error);
+                free(D);
+            }
+
+            free(ones);
+            free(b);
+            free(x);
+            csr_free(&A);
+        }
+    }
+
+    // the dot product alone, fast and reproducible, for every thread count up to the current one
+    int max_threads = omp_get_max_threads();
+    int n = 1 << 22;
+    double* x = malloc(sizeof(double) * n);
+    double* y = malloc(sizeof(double) * n);
+    for (int i = 0; i < n; i++)
+    {
+        x[i] = (double)rand() / RAND_MAX - 0.5;
+        y[i] = (double)rand() / RAND_MAX * 1e-3 * (i % 1000);
+    }
+    printf("\nthreads,n,fast_ms,deterministic_ms,fast_sum,deterministic_sum\n");
+    for (int p = 1; p <= max_threads; p++)
+    {
+        omp_set_num_threads(p);
+        const int reps = 20;
+        double fast = 0, reproducible = 0;
+        double start = omp_get_wtime();
+        deterministic_sums = false;
+        for (int r = 0; r < reps; r++) fast = dot(n, x, y);
+        double fast_ms = (omp_get_wtime() - start) * 1e3 / reps;
+        start = omp_get_wtime();
+        deterministic_sums = true;
+        for (int r = 0; r < reps; r++) reproducible = dot(n, x, y);
+        double deterministic_ms = (omp_get_wtime() - start) * 1e3 / reps;
+        printf("%d,%d,%.3f,%.3f,%a,%a\n", p, n, fast_ms, deterministic_ms, fast, reproducible);
+    }
+    free(x);
+    free(y);
+
+    if (history != NULL) fclose(history);
+    return 0;
+#endif
+}
+
+void csr_free(struct csr_matrix* A)
+{
+    free(A->row_ptr);
+    free(A->col);
+    free(A->val);
+}
+
+/**
+ * Five point finite difference matrix of -Δu + c*(u_x + u_y) on a k x k grid,
+ * n = k*k unknowns. With c = 0 this is the SPD Poisson matrix.
+ */
+void convection_diffusion_2d(struct csr_matrix* A, int k, double convection)
+{
+    int n = k * k;
+    A->n = n;
+    A->row_ptr = malloc(sizeof(int) * (n + 1));
+    A->col = malloc(sizeof(int) * 5 * n);
+    A->val = malloc(sizeof(double) * 5 * n);
+
+    int nnz = 0;
+    for (int i = 0; i < n; i++)
+    {
+        int gx = i % k, gy = i / k;
+        A->row_ptr[i] = nnz;
+        if (gy > 0) { A->col[nnz] = i - k; A->val[nnz++] = -1.0 - convection; }
+        if (gx > 0) { A->col[nnz] = i - 1; A->val[nnz++] = -1.0 - convection; }
+        A->col[nnz] = i; A->val[nnz++] = 4.0;
+        if (gx < k - 1) { A->col[nnz] = i + 1; A->val[nnz++] = -1.0 + convection; }
+        if (gy < k - 1) { A->col[nnz] = i + k; A->val[nnz++] = -1.0 + convection; }
+    }
+    A->row_ptr[n] = nnz;
+    A->nnz = nnz;
+}
+
+/**
+ * y = A x
+ */
+void spmv(const struct csr_matrix* A, const double* x, double* y)
+{
+    const int* restrict row_ptr = A->row_ptr;
+    const int* restrict col = A->col;
+    const double* restrict val = A->val;
+
+    #pragma omp parallel for schedule(static)
+    for (int i = 0; i < A->n; i++)
+    {
+        double sum = 0;
+        #pragma omp simd reduction(+:sum)
+        for (int p = row_ptr[i]; p < row_ptr[i + 1]; p++)
+        {
+            sum += val[p] * x[col[p]];
+        }
+        y[i] = sum;
+    }
+}
+
+/**
+ * Builds an incomplete factorization of A.
+ * ILU(0) keeps the sparsity pattern of A. ILUT drops entries smaller than
+ * drop_tol times the norm of their row and keeps at most `fill` entries in each
+ * of the L and U parts of a row.
+ * Returns 0 on success and -1 on a zero pivot.
+ */
+int precond_setup(struct preconditioner* M, const struct csr_matrix* A, enum precond_kind kind, double drop_tol, int fill)
+{
+    int n = A->n;
+    M->kind = kind;
+    M->diag = NULL;
+    memset(&M->F, 0, sizeof(M->F));
+    M->F.n = n;
+    if (kind == PRECOND_NONE) return 0;
+
+    M->diag = malloc(sizeof(int) * n);
+    int* pos = malloc(sizeof(int) * n);
+    for (int j = 0; j < n; j++)
+    {
+        pos[j] = -1;
+        M->diag[j] = -1;
+    }
+
+    if (kind == PRECOND_ILU0)
+    {
+        struct csr_matrix* F = &M->F;
+        F->n = n;
+        F->nnz = A->nnz;
+        F->row_ptr = malloc(sizeof(int) * (n + 1));
+        F->col = malloc(sizeof(int) * A->nnz);
+        F->val = malloc(sizeof(double) * A->nnz);
+        memcpy(F->row_ptr, A->row_ptr, sizeof(int) * (n + 1));
+        memcpy(F->col, A->col, sizeof(int) * A->nnz);
+        memcpy(F->val, A->val, sizeof(double) * A->nnz);
+
+        for (int i = 0; i < n; i++)
+        {
+            for (int p = F->row_ptr[i]; p < F->row_ptr[i + 1]; p++)
+            {
+                pos[F->col[p]] = p;
+                if (F->col[p] == i) M->diag[i] = p;
+            }
+            if (M->diag[i] < 0) break;
+
+            // L[i][k] = A[i][k] - Σ L[i][t] U[t][k], the sums being applied as soon as L[i][t] is final
+            for (int p = F->row_ptr[i]; p < M->diag[i]; p++)
+            {
+                int k = F->col[p];
+                double l = F->val[p];
+                for (int q = M->diag[k] + 1; q < F->row_ptr[k + 1]; q++)
+                {
+                    int j = pos[F->col[q]];
+                    if (j >= 0) F->val[j] -= l * F->val[q];
+                }
+            }
+
+            // U[i][j] = (A[i][j] - Σ L[i][t] U[t][j]) / L[i][i]
+            double pivot = F->val[M->diag[i]];
+            for (int p = F->row_ptr[i]; p < F->row_ptr[i + 1]; p++)
+            {
+                pos[F->col[p]] = -1;
+                if (F->col[p] > i) F->val[p] /= pivot;
+            }
+            if (pivot == 0)
+            {
+                M->diag[i] = -1;
+                break;
+            }
+        }
+    }
+    else
+    {
+        // ILUT: the same row recurrence on a dense work row, dropping small entries
+        int capacity = A->nnz + 2 * fill * n + n;
+        struct csr_matrix* F = &M->F;
+        F->n = n;
+        F->row_ptr = malloc(sizeof(int) * (n + 1));
+        F->col = malloc(sizeof(int) * capacity);
+        F->val = malloc(sizeof(double) * capacity);
+        double* w = calloc(n, sizeof(double));
+        int* lower = malloc(sizeof(int) * n);
+        int* upper = malloc(sizeof(int) * n);
+        struct sparse_entry* kept = malloc(sizeof(struct sparse_entry) * n);
+
+        int nnz = 0;
+        F->row_ptr[0] = 0;
+        for (int i = 0; i < n; i++)
+        {
+            int n_lower = 0, n_upper = 0;
+            double row_norm = 0;
+            w[i] = 0;
+            pos[i] = i;
+            for (int p = A->row_ptr[i]; p < A->row_ptr[i + 1]; p++)
+            {
+                int j = A->col[p];
+                w[j] = A->val[p];
+                row_norm += A->val[p] * A->val[p];
+                if (j < i) lower[n_lower++] = j;
+                else if (j > i) upper[n_upper++] = j;
+                pos[j] = j;
+            }
+            double tau = drop_tol * sqrt(row_norm);
+
+            // eliminate with the L entries in increasing column order; fill-in joins the lists
+            int n_kept = 0;
+            for (int done = 0; done < n_lower; done++)
+            {
+                int m = done;
+                for (int t = done + 1; t < n_lower; t++)
+                {
+                    if (lower[t] < lower[m]) m = t;
+                }
+                int k = lower[m];
+                lower[m] = lower[done];
+                lower[done] = k;
+
+                double l = w[k];
+                w[k] = 0;
+                pos[k] = -1;
+                if (fabs(l) < tau) continue;
+                kept[n_kept].value = l;
+                kept[n_kept++].col = k;
+
+                for (int q = M->diag[k] + 1; q < F->row_ptr[k + 1]; q++)
+                {
+                    int j = F->col[q];
+                    if (pos[j] < 0)
+                    {
+                        pos[j] = j;
+                        w[j] = 0;
+                        if (j < i) lower[n_lower++] = j;
+                        else upper[n_upper++] = j;
+                    }
+                    w[j] -= l * F->val[q];
+                }
+            }
+
+            // L part: the `fill` largest, in column order
+            qsort(kept, n_kept, sizeof(*kept), compare_magnitude);
+            if (n_kept > fill) n_kept = fill;
+            qsort(kept, n_kept, sizeof(*kept), compare_column);
+            for (int t = 0; t < n_kept; t++)
+            {
+                F->col[nnz] = kept[t].col;
+                F->val[nnz++] = kept[t].value;
+            }
+
+            double pivot = w[i];
+            if (pivot == 0) pivot = (drop_tol + 1e-4) * sqrt(row_norm);
+            M->diag[i] = nnz;
+            F->col[nnz] = i;
+            F->val[nnz++] = pivot;
+            w[i] = 0;
+            pos[i] = -1;
+            if (pivot == 0)
+            {
+                M->diag[i] = -1;
+                break;
+            }
+
+            // U part: drop, keep the `fill` largest, scale by the pivot like decompose() does
+            n_kept = 0;
+            for (int t = 0; t < n_upper; t++)
+            {
+                int j = upper[t];
+                if (fabs(w[j]) >= tau)
+                {
+                    kept[n_kept].value = w[j];
+                    kept[n_kept++].col = j;
+                }
+                w[j] = 0;
+                pos[j] = -1;
+            }
+            qsort(kept, n_kept, sizeof(*kept), compare_magnitude);
+            if (n_kept > fill) n_kept = fill;
+            qsort(kept, n_kept, sizeof(*kept), compare_column);
+            for (int t = 0; t < n_kept; t++)
+            {
+                F->col[nnz] = kept[t].col;
+                F->val[nnz++] = kept[t].value / pivot;
+            }
+            F->row_ptr[i + 1] = nnz;
+        }
+        F->nnz = nnz;
+
+        free(w);
+        free(lower);
+        free(upper);
+        free(kept);
+    }
+
+    free(pos);
+    for (int i = 0; i < n; i++)
+    {
+        if (M->diag[i] < 0)
+        {
+            fprintf(stderr, "ERROR: zero pivot in row %d of the incomplete factorization\n", i);
+            precond_free(M);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * z = M^-1 r: forward substitution with L (diagonal stored), then backward with unit U
+ */
+void precond_apply(const struct preconditioner* M, const double* r, double* z)
+{
+    const struct csr_matrix* F = &M->F;
+    int n = F->n;
+    if (M->kind == PRECOND_NONE)
+    {
+        memcpy(z, r, sizeof(double) * n);
+        return;
+    }
+
+    for (int i = 0; i < n; i++)
+    {
+        double sum = 0;
+        for (int p = F->row_ptr[i]; p < M->diag[i]; p++)
+        {
+            sum += F->val[p] * z[F->col[p]];
+        }
+        z[i] = (r[i] - sum) / F->val[M->diag[i]];
+    }
+    for (int i = n - 1; i >= 0; i--)
+    {
+        double sum = 0;
+        for (int p = M->diag[i] + 1; p < F->row_ptr[i + 1]; p++)
+        {
+            sum += F->val[p] * z[F->col[p]];
+        }
+        z[i] -= sum;
+    }
+}
+
+void precond_free(struct preconditioner* M)
+{
+    if (M->kind != PRECOND_NONE)
+    {
+        csr_free(&M->F);
+        free(M->diag);
+    }
+    M->kind = PRECOND_NONE;
+    M->diag = NULL;
+}
+
+/**
+ * Preconditioned conjugate gradients for SPD A; x holds the initial guess.
+ */
+struct krylov_stats cg(const struct csr_matrix* A, const struct preconditioner* M, const double* b, double* x,
+    double tol, int max_iter, FILE* monitor)
+{
+    int n = A->n;
+    double start = omp_get_wtime();
+    double* r = malloc(sizeof(double) * n);
+    double* z = malloc(sizeof(double) * n);
+    double* p = malloc(sizeof(double) * n);
+    double* q = malloc(sizeof(double) * n);
+    struct krylov_stats st = { 0, 0, 0, false };
+
+    double norm_b = norm2(n, b);
+    if (norm_b == 0) norm_b = 1;
+    residual(A, b, x, r);
+    precond_apply(M, r, z);
+    memcpy(p, z, sizeof(double) * n);
+    double rz = dot(n, r, z);
+    st.residual = norm2(n, r) / norm_b;
+    report(monitor, 0, st.residual, start);
+
+    while (st.residual > tol && st.iterations < max_iter)
+    {
+        spmv(A, p, q);
+        double alpha = rz / dot(n, p, q);
+        axpy(n, alpha, p, x);
+        axpy(n, -alpha, q, r);
+        st.iterations++;
+        st.residual = norm2(n, r) / norm_b;
+        report(monitor, st.iterations, st.residual, start);
+        if (st.residual <= tol) break;
+
+        precond_apply(M, r, z);
+        double rz_new = dot(n, r, z);
+        double beta = rz_new / rz;
+        rz = rz_new;
+        #pragma omp parallel for simd
+        for (int i = 0; i < n; i++)
+        {
+            p[i] = z[i] + beta * p[i];
+        }
+    }
+
+    // the recurrence for r drifts away from b - A x, report the true residual
+    residual(A, b, x, r);
+    st.residual = norm2(n, r) / norm_b;
+    st.converged = st.residual <= tol;
+    st.seconds = omp_get_wtime() - start;
+    free(r);
+    free(z);
+    free(p);
+    free(q);
+    return st;
+}
+
+/**
+ * Right preconditioned GMRES restarted every `restart` iterations,
+ * with modified Gram-Schmidt and Givens rotations.
+ */
+struct krylov_stats gmres(const struct csr_matrix* A, const struct preconditioner* M, const double* b, double* x,
+    int restart, double tol, int max_iter, FILE* monitor)
+{
+    int n = A->n;
+    int m = restart;
+    double start = omp_get_wtime();
+    double (*V)[n] = malloc(sizeof(double) * (m + 1) * n);
+    double (*H)[m] = malloc(sizeof(double) * (m + 1) * m);
+    double* cs = malloc(sizeof(double) * m);
+    double* sn = malloc(sizeof(double) * m);
+    double* g = malloc(sizeof(double) * (m + 1));
+    double* y = malloc(sizeof(double) * m);
+    double* z = malloc(sizeof(double) * n);
+    double* u = malloc(sizeof(double) * n);
+    struct krylov_stats st = { 0, 0, 0, false };
+
+    double norm_b = norm2(n, b);
+    if (norm_b == 0) norm_b = 1;
+    residual(A, b, x, V[0]);
+    double beta = norm2(n, V[0]);
+    st.residual = beta / norm_b;
+    report(monitor, 0, st.residual, start);
+
+    while (st.residual > tol && st.iterations < max_iter)
+    {
+        #pragma omp parallel for simd
+        for (int i = 0; i < n; i++) V[0][i] /= beta;
+        memset(g, 0, sizeof(double) * (m + 1));
+        g[0] = beta;
+
+        int j = 0;
+        for (; j < m && st.iterations < max_iter; j++)
+        {
+            precond_apply(M, V[j], z);
+            spmv(A, z, V[j + 1]);
+            for (int i = 0; i <= j; i++)
+            {
+                H[i][j] = dot(n, V[i], V[j + 1]);
+                axpy(n, -H[i][j], V[i], V[j + 1]);
+            }
+            H[j + 1][j] = norm2(n, V[j + 1]);
+            if (H[j + 1][j] != 0)
+            {
+                #pragma omp parallel for simd
+                for (int i = 0; i < n; i++) V[j + 1][i] /= H[j + 1][j];
+            }
+
+            for (int i = 0; i < j; i++)
+            {
+                double t = cs[i] * H[i][j] + sn[i] * H[i + 1][j];
+                H[i + 1][j] = -sn[i] * H[i][j] + cs[i] * H[i + 1][j];
+                H[i][j] = t;
+            }
+            double d = hypot(H[j][j], H[j + 1][j]);
+            cs[j] = H[j][j] / d;
+            sn[j] = H[j + 1][j] / d;
+            H[j][j] = d;
+            H[j + 1][j] = 0;
+            g[j + 1] = -sn[j] * g[j];
+            g[j] = cs[j] * g[j];
+
+            st.iterations++;
+            st.residual = fabs(g[j + 1]) / norm_b;
+            report(monitor, st.iterations, st.residual, start);
+            if (st.residual <= tol)
+            {
+                j++;
+                break;
+            }
+        }
+
+        // x += M^-1 V y with H y = g
+        for (int i = j - 1; i >= 0; i--)
+        {
+            y[i] = g[i];
+            for (int t = i + 1; t < j; t++) y[i] -= H[i][t] * y[t];
+            y[i] /= H[i][i];
+        }
+        memset(u, 0, sizeof(double) * n);
+        for (int i = 0; i < j; i++) axpy(n, y[i], V[i], u);
+        precond_apply(M, u, z);
+        axpy(n, 1.0, z, x);
+
+        // restart from the true residual
+        residual(A, b, x, V[0]);
+        beta = norm2(n, V[0]);
+        st.residual = beta / norm_b;
+        if (beta == 0) break;
+    }
+
+    st.converged = st.residual <= tol;
+    st.seconds = omp_get_wtime() - start;
+    free(V);
+    free(H);
+    free(cs);
+    free(sn);
+    free(g);
+    free(y);
+    free(z);
+    free(u);
+    return st;
+}
+
+/**
+ * Right preconditioned BiCGSTAB.
+ */
+struct krylov_stats bicgstab(const struct csr_matrix* A, const struct preconditioner* M, const double* b, double* x,
+    double tol, int max_iter, FILE* monitor)
+{
+    int n = A->n;
+    double start = omp_get_wtime();
+    double* r = malloc(sizeof(double) * n);
+    double* r_hat = malloc(sizeof(double) * n);
+    double* p = calloc(n, sizeof(double));
+    double* v = calloc(n, sizeof(double));
+    double* p_hat = malloc(sizeof(double) * n);
+    double* s_hat = malloc(sizeof(double) * n);
+    double* t = malloc(sizeof(double) * n);
+    struct krylov_stats st = { 0, 0, 0, false };
+
+    double norm_b = norm2(n, b);
+    if (norm_b == 0) norm_b = 1;
+    residual(A, b, x, r);
+    memcpy(r_hat, r, sizeof(double) * n);
+    double rho = 1, alpha = 1, omega = 1;
+    st.residual = norm2(n, r) / norm_b;
+    report(monitor, 0, st.residual, start);
+
+    while (st.residual > tol && st.iterations < max_iter)
+    {
+        double rho_new = dot(n, r_hat, r);
+        if (rho_new == 0) break;    // breakdown
+        double beta = (rho_new / rho) * (alpha / omega);
+        rho = rho_new;
+        #pragma omp parallel for simd
+        for (int i = 0; i < n; i++)
+        {
+            p[i] = r[i] + beta * (p[i] - omega * v[i]);
+        }
+
+        precond_apply(M, p, p_hat);
+        spmv(A, p_hat, v);
+        alpha = rho / dot(n, r_hat, v);
+        axpy(n, -alpha, v, r);      // r is s from here on
+        axpy(n, alpha, p_hat, x);
+        st.iterations++;
+        st.residual = norm2(n, r) / norm_b;
+        if (st.residual <= tol)
+        {
+            report(monitor, st.iterations, st.residual, start);
+            break;
+        }
+
+        precond_apply(M, r, s_hat);
+        spmv(A, s_hat, t);
+        omega = dot(n, t, r) / dot(n, t, t);
+        axpy(n, omega, s_hat, x);
+        axpy(n, -omega, t, r);
+        st.residual = norm2(n, r) / norm_b;
+        report(monitor, st.iterations, st.residual, start);
+        if (omega == 0) break;
+    }
+
+    residual(A, b, x, r);
+    st.residual = norm2(n, r) / norm_b;
+    st.converged = st.residual <= tol;
+    st.seconds = omp_get_wtime() - start;
+    free(r);
+    free(r_hat);
+    free(p);
+    free(v);
+    free(p_hat);
+    free(s_hat);
+    free(t);
+    return st;
+}
+
+static double dot(int n, const double* x, const double* y)
+{
+    if (deterministic_sums) return dot_reproducible(n, x, y);
+
+    double sum = 0;
+    #pragma omp parallel for simd reduction(+:sum) schedule(static)
+    for (int i = 0; i < n; i++)
+    {
+        sum += x[i] * y[i];
+    }
+    return sum;
+}
+
+/**
+ * x . y with a summation order fixed by n alone: four interleaved sums inside
+ * each chunk of DOT_CHUNK elements, then a pairwise tree over the chunks. Which
+ * thread sums which chunk doesn't matter, so the result is the same for any
+ * number of threads and any schedule.
+ */
+static double dot_reproducible(int n, const double* x, const double* y)
+{
+    int chunks = (n + DOT_CHUNK - 1) / DOT_CHUNK;
+    if (chunks == 0) return 0;
+    double partial[chunks];
+
+    #pragma omp parallel for schedule(static)
+    for (int c = 0; c < chunks; c++)
+    {
+        int begin = c * DOT_CHUNK;
+        int end = (begin + DOT_CHUNK < n) ? begin + DOT_CHUNK : n;
+        double s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+        int i = begin;
+        for (; i + 4 <= end; i += 4)
+        {
+            s0 += x[i] * y[i];
+            s1 += x[i + 1] * y[i + 1];
+            s2 += x[i + 2] * y[i + 2];
+            s3 += x[i + 3] * y[i + 3];
+        }
+        for (; i < end; i++)
+        {
+            s0 += x[i] * y[i];
+        }
+        partial[c] = (s0 + s1) + (s2 + s3);
+    }
+
+    for (int width = 1; width < chunks; width *= 2)
+    {
+        for (int c = 0; c + width < chunks; c += 2 * width)
+        {
+            partial[c] += partial[c + width];
+        }
+    }
+    return partial[0];
+}
+
+static double norm2(int n, const double* x)
+{
+    return sqrt(dot(n, x, x));
+}
+
+/**
+ * y += alpha * x
+ */
+static void axpy(int n, double alpha, const double* x, double* y)
+{
+    #pragma omp parallel for simd schedule(static)
+    for (int i = 0; i < n; i++)
+    {
+        y[i] += alpha * x[i];
+    }
+}
+
+/**
+ * r = b - A x
+ */
+static void residual(const struct csr_matrix* A, const double* b, const double* x, double* r)
+{
+    spmv(A, x, r);
+    #pragma omp parallel for simd schedule(static)
+    for (int i = 0; i < A->n; i++)
+    {
+        r[i] = b[i] - r[i];
+    }
+}
+
+static void report(FILE* monitor, int iteration, double residual, double start)
+{
+    if (monitor == NULL) return;
+    fprintf(monitor, "%d,%.6e,%.3f\n", iteration, residual, (omp_get_wtime() - start) * 1e3);
+}
+
+// larger magnitude first
+static int compare_magnitude(const void* a, const void* b)
+{
+    double x = fabs(((const struct sparse_entry*)a)->value);
+    double y = fabs(((const struct sparse_entry*)b)->value);
+    return (x < y) - (x > y);
+}
+
+static int compare_column(const void* a, const void* b)
+{
+    const struct sparse_entry* x = a;
+    const struct sparse_entry* y = b;
+    return (x->col > y->col) - (x->col < y->col);
+}
@@ -0,0 +1,544 @@
+// vim: noai:ts=4:sw=4
+
+/*
+recipe:
+> `gcc --std=c99 -O3 -march=native -fopenmp -DNOMAIN -DHIDEDUP gausselim.c crout.c luinverse.c -o luinverse -lm`
+> run: `./luinverse [--threads <p>] [--max-n <n>] [--max-ref-n <n>]`
+> define TEST macro for running tests: `gcc --std=c99 -fopenmp -DNOMAIN -DHIDEDUP -DTEST gausselim.c crout.c luinverse.c -o luinverse -lm`
+
+Matrix inverse and determinant from a single factorization.
+Inverting A column by column with gauss_elim() factorizes A again for every
+unit vector, n eliminations of O(n^3) each. Here A is factorized once and the
+n right-hand sides of A X = I are solved together:
+
+    - lu_inverse() runs eliminate() on A once, recording its row operations
+      (multipliers and interchanges), replays them on the columns of I to get
+      Y with U X = Y, and back substitutes all columns of Y.
+    - crout_inverse() takes L and U from decompose(), solves L Y = I and
+      then U X = Y.
+
+The columns of X are independent, so the replay and the triangular solves
+are split into blocks of BLOCK_COLUMNS columns and the blocks are shared among the threads.
+Inside a block the solve walks the rows of U (or L) and updates a short row of
+X at a time, which keeps the block in cache and lets the compiler vectorize.
+
+The determinant is the product of the pivots, with the sign flipped for every
+row interchange. The product of a few hundred pivots easily over- or
+underflows a double, so it is returned as log|det A| and the sign.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <math.h>
+#include <omp.h>
+#ifdef TEST
+#include <assert.h>
+#endif
+
+extern int gauss_elim(int m, int n, double A[][n], double* x, bool do_partial_pivoting, bool augmented_matrix, int precision);
+extern int eliminate_counting_swaps(int m, int n, double A[][n], bool do_partial_pivoting, bool augmented_matrix, int precision, int* swaps);
+extern int eliminate_recording(int m, int n, double A[][n], bool do_partial_pivoting, bool augmented_matrix, int precision, int* swaps,
+    int* op_row, int* op_pivot, double* op_multiplier, int* num_ops);
+extern void decompose(int n, double A[][n], double L[][n], double U[][n], int precision);
+
+int lu_inverse(int n, double A[][n], double Ainv[][n], bool do_partial_pivoting, int precision, double* log_abs_det, int* det_sign);
+int lu_log_det(int n, double A[][n], bool do_partial_pivoting, int precision, double* log_abs_det, int* det_sign);
+int crout_inverse(int n, double L[][n], double U[][n], double Ainv[][n]);
+int crout_log_det(int n, double L[][n], double* log_abs_det, int* det_sign);
+
+static int diagonal_log_det(int n, int lda, double A[][lda], int swaps, double* log_abs_det, int* det_sign);
+static void replay_on_identity_block(int n, int num_ops, const int* op_row, const int* op_pivot, const double* op_multiplier,
+    int c0, int c1, double X[][n]);
+static void backward_solve_block(int n, int lda, double U[][lda], bool unit_diagonal, int c0, int c1, double X[][n]);
+static void forward_solve_identity_block(int n, double L[][n], int c0, int c1, double X[][n]);
+
+#define BLOCK_COLUMNS 32    // columns of X solved together by one thread
+
+/**
+ * max |A * Ainv - I|
+ */
+static double identity_error(int n, double A[][n], double Ainv[][n])
+{
+    double max = 0;
+    #pragma omp parallel for reduction(max:max)
+    for (int i = 0; i < n; i++)
+    {
+        for (int j = 0; j < n; j++)
+        {
+            double sum = 0;
+            for (int k = 0; k < n; k++) sum += A[i][k] * Ainv[k][j];
+            double e = fabs(sum - (i == j ? 1.0 : 0.0));
+            if (max < e) max = e;
+        }
+    }
+    return max;
+}
+
+#ifdef TEST
+#define EPSILON 1e-8
+static void test_1()
+{
+    // A * Ainv = I for both paths, sizes around the column block
+    int sizes[] = { 1, 2, 31, 32, 33, 100 };
+    srand(7);
+    for (int s = 0; s < sizeof(sizes)/sizeof(int); s++)
+    {
+        int n = sizes[s];
+        double (*A)[n] = malloc(sizeof(double) * n * n);
+        double (*Ainv)[n] = malloc(sizeof(double) * n * n);
+        double (*L)[n] = calloc((size_t)n * n, sizeof(double));
+        double (*U)[n] = calloc((size_t)n * n, sizeof(double));
+        for (int i = 0; i < n; i++)
+        {
+            for (int j = 0; j < n; j++)
+            {
+                A[i][j] = (double)rand() / RAND_MAX - 0.5 + (i == j ? n : 0);
+            }
+        }
+
+        double log_abs_det;
+        int sign;
+        assert(lu_inverse(n, A, Ainv, true, 15, &log_abs_det, &sign) == 0);
+        assert(identity_error(n, A, Ainv) <= EPSILON);
+
+        double crout_log_abs_det;
+        int crout_sign;
+        decompose(n, A, L, U, -1);
+        assert(crout_inverse(n, L, U, Ainv) == 0);
+        assert(identity_error(n, A, Ainv) <= EPSILON);
+        assert(crout_log_det(n, L, &crout_log_abs_det, &crout_sign) == 0);
+        assert(sign == crout_sign);
+        assert(fabs(log_abs_det - crout_log_abs_det) <= 1e-6 * fabs(log_abs_det) + EPSILON);
+
+        free(A);
+        free(Ainv);
+        free(L);
+        free(U);
+    }
+}
+
+static void test_2()
+{
+    // det = 781 with interchanges, and det = -2 with a zero leading pivot
+    double A[3][3] = {
+        { 2, 7, 8 },
+        { 9, -3, 4 },
+        { 1, 6, -5 }
+    };
+    double B[3][3] = {
+        { 0, 1, 2 },
+        { 1, 0, 3 },
+        { 4, -3, 8 }
+    };
+    double log_abs_det;
+    int sign;
+    assert(lu_log_det(3, A, true, 15, &log_abs_det, &sign) == 0);
+    assert(sign == 1 && fabs(exp(log_abs_det) - 781) <= 1e-6);
+    assert(lu_log_det(3, B, true, 15, &log_abs_det, &sign) == 0);
+    assert(sign == -1 && fabs(exp(log_abs_det) - 2) <= 1e-9);
+    assert(A[0][0] == 2 && B[0][0] == 0);   // inputs are left alone
+}
+
+static void test_3()
+{
+    // singular matrix, and a determinant far outside the range of a double
+    double S[3][3] = {
+        { 1, 2, 3 },
+        { 2, 4, 6 },
+        { 1, 0, 1 }
+    };
+    double Sinv[3][3];
+    double log_abs_det;
+    int sign;
+    assert(lu_inverse(3, S, Sinv, true, 15, &log_abs_det, &sign) == -1);
+    assert(sign == 0 && isinf(log_abs_det) && log_abs_det < 0);
+
+    int n = 400;
+    double (*A)[n] = calloc((size_t)n * n, sizeof(double));
+    for (int i = 0; i < n; i++) A[i][i] = (i % 2 == 0) ? 1e3 : -1e3;
+    assert(lu_log_det(n, A, true, 15, &log_abs_det, &sign) == 0);
+    assert(sign == 1 && fabs(log_abs_det - n * log(1e3)) <= 1e-9 * n * log(1e3));
+    free(A);
+}
+
+static void test_4()
+{
+    // the recorded interchanges: a zero leading pivot, and matrices where
+    // eliminate() swaps the pivot row several times in one column
+    double B[3][3] = {
+        { 0, 1, 2 },
+        { 1, 0, 3 },
+        { 4, -3, 8 }
+    };
+    double Binv[3][3];
+    assert(lu_inverse(3, B, Binv, true, 15, NULL, NULL) == 0);
+    assert(identity_error(3, B, Binv) <= EPSILON);
+
+    int n = 70;
+    double (*A)[n] = malloc(sizeof(double) * n * n);
+    double (*Ainv)[n] = malloc(sizeof(double) * n * n);
+    srand(11);
+    for (int t = 0; t < 3; t++)
+    {
+        for (int i = 0; i < n; i++)
+        {
+            for (int j = 0; j < n; j++)
+            {
+                A[i][j] = (double)rand() / RAND_MAX - 0.5;
+            }
+        }
+        assert(lu_inverse(n, A, Ainv, true, 15, NULL, NULL) == 0);
+        assert(identity_error(n, A, Ainv) <= 1e-6);
+    }
+    free(A);
+    free(Ainv);
+}
+#endif
+
+int main(int argc, char** argv)
+{
+#ifdef TEST
+    printf("Running tests\n");
+    test_1();
+    test_2();
+    test_3();
+    test_4();
+    printf("Finished running tests\n");
+
+    return 0;
+#else
+    /** input: parse command line arguments **/
+    int threads = omp_get_max_threads();
+    int max_n = 512;
+    int max_ref_n = 128;    // n calls to gauss_elim(), O(n^4)
+    for (int arg_i = 1; arg_i < argc; arg_i++)
+    {
+        if (strcmp(argv[arg_i], "--threads") == 0 && arg_i + 1 < argc)
+            threads = atoi(argv[++arg_i]);
+        else if (strcmp(argv[arg_i], "--max-n") == 0 && arg_i + 1 < argc)
+            max_n = atoi(argv[++arg_i]);
+        else if (strcmp(argv[arg_i], "--max-ref-n") == 0 && arg_i + 1 < argc)
+            max_ref_n = atoi(argv[++arg_i]);
+        else
+            printf("WARNING: unrecognized option %s\n", argv[arg_i]);
+    }
+    omp_set_num_threads(threads);
+
+    // lu_inverse() is eliminate() (which rounds every operation) plus the solves;
+    // eliminate_ms is the factorization alone, via lu_log_det()
+    printf("n,threads,per_column_ms,eliminate_ms,lu_inverse_ms,lu_error,crout_inverse_ms,crout_error\n");
+    for (int n = 32; n <= max_n; n *= 2)
+    {
+        double (*A)[n] = malloc(sizeof(double) * n * n);
+        double (*Ainv)[n] = malloc(sizeof(double) * n * n);
+        double (*L)[n] = calloc((size_t)n * n, sizeof(double));
+        double (*U)[n] = calloc((size_t)n * n, sizeof(double));
+        for (int i = 0; i < n; i++)
+        {
+            for (int j = 0; j < n; j++)
+            {
+                A[i][j] = rand() % 100 + (i == j ? 100 * n : 0);
+            }
+        }
+
+        // the old way: one gauss_elim() per unit vector
+        double per_column_ms = -1;
+        if (n <= max_ref_n)
+        {
+            double (*E)[n + 1] = malloc(sizeof(double) * n * (n + 1));
+            double x[n];
+            double start = omp_get_wtime();
+            for (int j = 0; j < n; j++)
+            {
+                for (int i = 0; i < n; i++)
+                {
+                    memcpy(E[i], A[i], sizeof(double) * n);
+                    E[i][n] = (i == j);
+                }
+                gauss_elim(n, n + 1, E, x, true, true, 15);
+                for (int i = 0; i < n; i++) Ainv[i][j] = x[i];
+            }
+            per_column_ms = (omp_get_wtime() - start) * 1e3;
+            free(E);
+        }
+
+        double log_abs_det;
+        int sign;
+        double start = omp_get_wtime();
+        lu_log_det(n, A, true, 15, &log_abs_det, &sign);
+        double eliminate_ms = (omp_get_wtime() - start) * 1e3;
+
+        start = omp_get_wtime();
+        lu_inverse(n, A, Ainv, true, 15, &log_abs_det, &sign);
+        double lu_ms = (omp_get_wtime() - start) * 1e3;
+        double lu_error = identity_error(n, A, Ainv);
+
+        start = omp_get_wtime();
+        decompose(n, A, L, U, -1);
+        crout_inverse(n, L, U, Ainv);
+        double crout_ms = (omp_get_wtime() - start) * 1e3;
+        double crout_error = identity_error(n, A, Ainv);
+
+        printf("%d,%d,%.3f,%.3f,%.3f,%.3e,%.3f,%.3e\n", n, threads, per_column_ms, eliminate_ms, lu_ms, lu_error,
+            crout_ms, crout_error);
+        fflush(stdout);
+
+        free(A);
+        free(Ainv);
+        free(L);
+        free(U);
+    }
+
+    // determinant of a matrix whose pivots multiply past DBL_MAX
+    int n = max_n;
+    double (*A)[n] = malloc(sizeof(double) * n * n);
+    double (*L)[n] = calloc((size_t)n * n, sizeof(double));
+    double (*U)[n] = calloc((size_t)n * n, sizeof(double));
+    for (int i = 0; i < n; i++)
+    {
+        for (int j = 0; j < n; j++)
+        {
+            A[i][j] = rand() % 100 + (i == j ? 100 * n : 0);
+        }
+    }
+    double log_abs_det;
+    int sign;
+    decompose(n, A, L, U, -1);
+    crout_log_det(n, L, &log_abs_det, &sign);
+    double product = 1;
+    for (int i = 0; i < n; i++) product *= L[i][i];
+    printf("\nn = %d: product of pivots = %g, log|det| = %.6f, sign = %d, det = %.6fe%+.0f\n",
+        n, product, log_abs_det, sign, sign * pow(10, fmod(log_abs_det / log(10), 1)),
+        floor(log_abs_det / log(10)));
+
+    free(A);
+    free(L);
+    free(U);
+
+    return 0;
+#endif
+}
+
+/**
+ * Computes Ainv = A^-1 with one eliminate() of A, whose row operations are then
+ * applied to the columns of I, and a back substitution of all n columns.
+ * precision is passed on to eliminate(); the solves on the columns of I are in
+ * full precision. The determinant is
+ * returned as log_abs_det = log|det A| and det_sign (either may be NULL).
+ * Returns 0 on success and -1 if A is singular, in which case det_sign is 0,
+ * log_abs_det is -inf and Ainv is left unchanged.
+ */
+int lu_inverse(int n, double A[][n], double Ainv[][n], bool do_partial_pivoting, int precision, double* log_abs_det, int* det_sign)
+{
+    double (*W)[n] = malloc(sizeof(double) * n * n);
+    memcpy(W, A, sizeof(double) * n * n);
+    size_t max_ops = (size_t)n * n;
+    int* op_row = malloc(sizeof(int) * max_ops);
+    int* op_pivot = malloc(sizeof(int) * max_ops);
+    double* op_multiplier = malloc(sizeof(double) * max_ops);
+
+    int swaps, num_ops;
+    eliminate_recording(n, n, W, do_partial_pivoting, false, precision, &swaps, op_row, op_pivot, op_multiplier, &num_ops);
+    int ret = diagonal_log_det(n, n, W, swaps, log_abs_det, det_sign);
+    if (ret == 0)
+    {
+        int blocks = (n + BLOCK_COLUMNS - 1) / BLOCK_COLUMNS;
+        #pragma omp parallel for schedule(static)
+        for (int b = 0; b < blocks; b++)
+        {
+            int c0 = b * BLOCK_COLUMNS;
+            int c1 = (c0 + BLOCK_COLUMNS < n) ? c0 + BLOCK_COLUMNS : n;
+            replay_on_identity_block(n, num_ops, op_row, op_pivot, op_multiplier, c0, c1, Ainv);
+            backward_solve_block(n, n, W, false, c0, c1, Ainv);
+        }
+    }
+
+    free(W);
+    free(op_row);
+    free(op_pivot);
+    free(op_multiplier);
+    return ret;
+}
+
+/**
+ * log|det A| and its sign from eliminate() on a copy of A; A is not modified.
+ * Returns 0 on success and -1 if A is singular.
+ */
+int lu_log_det(int n, double A[][n], bool do_partial_pivoting, int precision, double* log_abs_det, int* det_sign)
+{
+    double (*W)[n] = malloc(sizeof(double) * n * n);
+    memcpy(W, A, sizeof(double) * n * n);
+
+    int swaps;
+    eliminate_counting_swaps(n, n, W, do_partial_pivoting, false, precision, &swaps);
+    int ret = diagonal_log_det(n, n, W, swaps, log_abs_det, det_sign);
+
+    free(W);
+    return ret;
+}
+
+/**
+ * Computes Ainv = A^-1 = U^-1 L^-1 from the factors of decompose().
+ * Returns 0 on success and -1 if L has a zero on the diagonal.
+ */
+int crout_inverse(int n, double L[][n], double U[][n], double Ainv[][n])
+{
+    for (int i = 0; i < n; i++)
+    {
+        if (L[i][i] == 0) return -1;
+    }
+
+    // column j of L^-1 is zero above row j, so later blocks have less work
+    int blocks = (n + BLOCK_COLUMNS - 1) / BLOCK_COLUMNS;
+    #pragma omp parallel for schedule(dynamic)
+    for (int b = 0; b < blocks; b++)
+    {
+        int c0 = b * BLOCK_COLUMNS;
+        int c1 = (c0 + BLOCK_COLUMNS < n) ? c0 + BLOCK_COLUMNS : n;
+        forward_solve_identity_block(n, L, c0, c1, Ainv);
+        backward_solve_block(n, n, U, true, c0, c1, Ainv);
+    }
+
+    return 0;
+}
+
+/**
+ * log|det A| and its sign from the diagonal of L of decompose() (U has a unit diagonal).
+ * Returns 0 on success and -1 if A is singular.
+ */
+int crout_log_det(int n, double L[][n], double* log_abs_det, int* det_sign)
+{
+    return diagonal_log_det(n, n, L, 0, log_abs_det, det_sign);
+}
+
+/**
+ * Sums log|A[i][i]| instead of multiplying the diagonal, so the result does not
+ * over- or underflow; every interchange flips the sign.
+ */
+static int diagonal_log_det(int n, int lda, double A[][lda], int swaps, double* log_abs_det, int* det_sign)
+{
+    double sum = 0;
+    int sign = (swaps % 2 == 0) ? 1 : -1;
+    for (int i = 0; i < n; i++)
+    {
+        if (A[i][i] == 0)
+        {
+            sign = 0;
+            sum = -INFINITY;
+            break;
+        }
+        if (A[i][i] < 0) sign = -sign;
+        sum += log(fabs(A[i][i]));
+    }
+
+    if (log_abs_det != NULL) *log_abs_det = sum;
+    if (det_sign != NULL) *det_sign = sign;
+    return (sign == 0) ? -1 : 0;
+}
+
+/**
+ * Stores the columns c0..c1-1 of I in X and applies the row operations recorded
+ * by eliminate_recording() to them, in order.
+ */
+static void replay_on_identity_block(int n, int num_ops, const int* op_row, const int* op_pivot, const double* op_multiplier,
+    int c0, int c1, double X[][n])
+{
+    for (int i = 0; i < n; i++)
+    {
+        double* x = &X[i][c0];
+        for (int j = 0; j < c1 - c0; j++)
+        {
+            x[j] = (c0 + j == i);
+        }
+    }
+
+    for (int p = 0; p < num_ops; p++)
+    {
+        double* pivot_row = &X[op_pivot[p]][c0];
+        if (op_row[p] < 0)
+        {
+            double* other = &X[-1 - op_row[p]][c0];
+            for (int j = 0; j < c1 - c0; j++)
+            {
+                double t = pivot_row[j];
+                pivot_row[j] = other[j];
+                other[j] = t;
+            }
+        }
+        else
+        {
+            double* x = &X[op_row[p]][c0];
+            double multiplier = op_multiplier[p];
+            for (int j = 0; j < c1 - c0; j++)
+            {
+                x[j] -= multiplier * pivot_row[j];
+            }
+        }
+    }
+}
+
+/**
+ * Solves U X = X in place for the columns c0..c1-1 of X, U upper triangular
+ * (stored in the first n columns of an n x lda array).
+ */
+static void backward_solve_block(int n, int lda, double U[][lda], bool unit_diagonal, int c0, int c1, double X[][n])
+{
+    for (int i = n - 1; i >= 0; i--)
+    {
+        double* x = &X[i][c0];
+        for (int k = i + 1; k < n; k++)
+        {
+            double u = U[i][k];
+            if (u == 0) continue;
+            double* y = &X[k][c0];
+            for (int j = 0; j < c1 - c0; j++)
+            {
+                x[j] -= u * y[j];
+            }
+        }
+        if (!unit_diagonal)
+        {
+            double d = U[i][i];
+            for (int j = 0; j < c1 - c0; j++)
+            {
+                x[j] /= d;
+            }
+        }
+    }
+}
+
+/**
+ * Stores the columns c0..c1-1 of L^-1 in X, by solving L Y = I; rows above c0 are zero.
+ */
+static void forward_solve_identity_block(int n, double L[][n], int c0, int c1, double X[][n])
+{
+    for (int i = 0; i < c0; i++)
+    {
+        memset(&X[i][c0], 0, sizeof(double) * (c1 - c0));
+    }
+    for (int i = c0; i < n; i++)
+    {
+        double* x = &X[i][c0];
+        for (int j = 0; j < c1 - c0; j++)
+        {
+            x[j] = (c0 + j == i);
+        }
+        for (int k = c0; k < i; k++)
+        {
+            double l = L[i][k];
+            if (l == 0) continue;
+            double* y = &X[k][c0];
+            for (int j = 0; j < c1 - c0; j++)
+            {
+                x[j] -= l * y[j];
+            }
+        }
+        double d = L[i][i];
+        for (int j = 0; j < c1 - c0; j++)
+        {
+            x[j] /= d;
+        }
+    }
+}
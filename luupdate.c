@@ -0,0 +1,593 @@
+// vim: noai:ts=4:sw=4
+
+/*
+recipe:
+> `gcc --std=c99 -O2 -DNOMAIN crout.c luupdate.c -o luupdate -lm`
+> define TEST macro for running tests: `gcc --std=c99 -DNOMAIN -DTEST crout.c luupdate.c -o luupdate -lm`
+
+Low-rank updates of a Crout factorization A0 = L*U from decompose().
+When A changes by a few rows or columns, A = A0 + u1*v1' + ... + uk*vk', the
+factors are kept and solves apply the Sherman-Morrison-Woodbury correction
+
+    A^-1 b = y - Z * S^-1 * V' * y,   y = A0^-1 b,  Z = A0^-1 U,  S = I + V' * Z
+
+which costs O(k*n^2) for k updates instead of the O(n^3) of a new decompose().
+Once max_rank updates have accumulated, or when S or the solve residual shows
+that the correction has become unstable, A is factorized again.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <math.h>
+#include <sys/time.h>
+#ifdef PRINTDEBUG
+#include <stdarg.h>
+#endif
+#ifdef TEST
+#include <assert.h>
+#endif
+
+extern void decompose(int n, double A[][n], double L[][n], double U[][n], int precision);
+extern void forward_substitution(int n, double L[][n], double y[n], double b[n]);
+extern void backward_substitution(int n, double U[][n], double x[n], double y[n]);
+
+/** factorization of A0 plus the accumulated rank-1 terms A = A0 + Σ u_r v_r' **/
+struct lu_update
+{
+    int n;
+    int precision;          // passed on to decompose(), -1 for full precision
+    int max_rank;           // refactor once this many terms have accumulated
+    int rank;               // number of terms accumulated since the last refactor
+    int refactor_count;
+    double* A;              // current matrix, n x n
+    double* L;              // Crout factors of A0, n x n
+    double* U;
+    double* V;              // v_r, max_rank x n
+    double* Z;              // A0^-1 u_r, max_rank x n
+    double* S;              // capacitance matrix I + V'Z, max_rank x max_rank
+    double* S_lu;           // LU factors of S with partial pivoting
+    int* S_piv;
+};
+
+#define CAPACITANCE_PIVOT_TOLERANCE 1e-10
+#define RESIDUAL_TOLERANCE 1e-10
+
+int lu_update_init(struct lu_update* F, int n, double A[][n], int max_rank, int precision);
+void lu_update_free(struct lu_update* F);
+int lu_update_refactor(struct lu_update* F);
+int lu_update_rank1(struct lu_update* F, const double* u, const double* v);
+int lu_update_rank_k(struct lu_update* F, int k, double U[][k], double V[][k]);
+int lu_update_replace_row(struct lu_update* F, int row, const double* a);
+int lu_update_replace_col(struct lu_update* F, int col, const double* a);
+int lu_update_solve(struct lu_update* F, const double* b, double* x);
+
+static void base_solve(struct lu_update* F, const double* b, double* x);
+static bool factorize_capacitance(struct lu_update* F);
+static void capacitance_solve(struct lu_update* F, double* t);
+static double relative_residual(struct lu_update* F, const double* b, const double* x);
+#ifndef TEST
+static long get_elapsed_us(struct timeval* begin);
+#endif
+static void debug_message(const char* message, ...);
+
+#ifdef TEST
+#define EPSILON 1e-9
+static void fill_test_matrix(int n, double A[][n])
+{
+    srand(11);
+    for (int i = 0; i < n; i++)
+    {
+        for (int j = 0; j < n; j++)
+        {
+            A[i][j] = (i == j) ? n : (rand() % 100) / 100.0;
+        }
+    }
+}
+
+// solves A x = b from scratch with decompose()
+static void reference_solve(int n, double A[][n], const double* b, double* x)
+{
+    double L[n][n], U[n][n], y[n], bb[n];
+    memset(L, 0, sizeof(L));
+    memset(U, 0, sizeof(U));
+    memcpy(bb, b, sizeof(bb));
+    decompose(n, A, L, U, -1);
+    forward_substitution(n, L, y, bb);
+    backward_substitution(n, U, x, y);
+}
+
+void test_1()
+{
+    // replacing rows and columns gives the same solution as a fresh factorization
+    int n = 6;
+    double A[n][n], b[n], x[n], x_ref[n];
+    fill_test_matrix(n, A);
+    for (int i = 0; i < n; i++) b[i] = i + 1;
+
+    struct lu_update F;
+    assert(lu_update_init(&F, n, A, 4, -1) == 0);
+
+    double row[6] = { 1, 7, 0.5, -2, 3, 0 };
+    assert(lu_update_replace_row(&F, 2, row) == 0);
+    memcpy(A[2], row, sizeof(row));
+    assert(lu_update_solve(&F, b, x) == 0);
+    reference_solve(n, A, b, x_ref);
+    for (int i = 0; i < n; i++) assert(fabs(x[i] - x_ref[i]) <= EPSILON);
+
+    double col[6] = { 0.25, -1, 2, 8, 0, 1 };
+    assert(lu_update_replace_col(&F, 4, col) == 0);
+    for (int i = 0; i < n; i++) A[i][4] = col[i];
+    assert(lu_update_solve(&F, b, x) == 0);
+    reference_solve(n, A, b, x_ref);
+    for (int i = 0; i < n; i++) assert(fabs(x[i] - x_ref[i]) <= EPSILON);
+
+    assert(F.rank == 2);
+    assert(F.refactor_count == 0);
+    lu_update_free(&F);
+}
+
+void test_2()
+{
+    // a rank-3 update on a max_rank of 2 folds the terms into a new factorization
+    int n = 5;
+    double A[n][n], b[n], x[n], x_ref[n];
+    double U[5][3] = { { 1, 0, 0 }, { 0, 1, 0 }, { 0, 0, 1 }, { 1, 1, 1 }, { 0, 2, 0 } };
+    double V[5][3] = { { 0.5, 0, 1 }, { 0, -1, 0 }, { 2, 0, 0 }, { 0, 0, 0.5 }, { 1, 1, 0 } };
+    fill_test_matrix(n, A);
+    for (int i = 0; i < n; i++) b[i] = 1.0 - i;
+
+    struct lu_update F;
+    assert(lu_update_init(&F, n, A, 2, -1) == 0);
+    assert(lu_update_rank_k(&F, 3, U, V) == 0);
+    assert(F.refactor_count == 1);
+    assert(lu_update_solve(&F, b, x) == 0);
+
+    for (int i = 0; i < n; i++)
+    {
+        for (int j = 0; j < n; j++)
+        {
+            for (int r = 0; r < 3; r++) A[i][j] += U[i][r] * V[j][r];
+        }
+    }
+    reference_solve(n, A, b, x_ref);
+    for (int i = 0; i < n; i++) assert(fabs(x[i] - x_ref[i]) <= EPSILON);
+    lu_update_free(&F);
+}
+#endif
+
+int main(int argc, char** argv)
+{
+#ifdef TEST
+    printf("Running tests\n");
+    test_1();
+    test_2();
+    printf("Finished running tests\n");
+
+    return 0;
+#else
+    // each step replaces one row; compare a fresh decompose() against the update
+    int steps = 8;
+    printf("n,steps,refactor_us,update_us,max_diff\n");
+    for (int n = 50; n <= 800; n += n < 200 ? 50 : 200)
+    {
+        double (*A)[n] = malloc(sizeof(double) * n * n);
+        double (*L)[n] = malloc(sizeof(double) * n * n);
+        double (*U)[n] = malloc(sizeof(double) * n * n);
+        double* b = malloc(sizeof(double) * n);
+        double* x = malloc(sizeof(double) * n);
+        double* y = malloc(sizeof(double) * n);
+        double* x_ref = malloc(sizeof(double) * n);
+        double* row = malloc(sizeof(double) * n);
+        for (int i = 0; i < n; i++)
+        {
+            for (int j = 0; j < n; j++)
+            {
+                A[i][j] = (i == j) ? n : rand() % 100 / 100.0;
+            }
+            b[i] = rand() % 100;
+        }
+
+        // a zero pivot leaves nothing to update, so that size gets no row
+        struct lu_update F;
+        bool factored = lu_update_init(&F, n, A, steps, -1) == 0;
+        if (!factored) printf("ERROR: lu_update_init() failed for n = %d\n", n);
+
+        long refactor_us = 0, update_us = 0;
+        double max_diff = 0;
+        struct timeval begin;
+        for (int s = 0; factored && s < steps; s++)
+        {
+            int r = rand() % n;
+            for (int j = 0; j < n; j++)
+            {
+                row[j] = (r == j) ? n : rand() % 100 / 100.0;
+            }
+
+            gettimeofday(&begin, 0);
+            lu_update_replace_row(&F, r, row);
+            lu_update_solve(&F, b, x);
+            update_us += get_elapsed_us(&begin);
+
+            gettimeofday(&begin, 0);
+            memcpy(A[r], row, sizeof(double) * n);
+            memset(L, 0, sizeof(double) * n * n);
+            memset(U, 0, sizeof(double) * n * n);
+            memcpy(y, b, sizeof(double) * n);
+            decompose(n, A, L, U, -1);
+            forward_substitution(n, L, x_ref, y);
+            memcpy(y, x_ref, sizeof(double) * n);
+            backward_substitution(n, U, x_ref, y);
+            refactor_us += get_elapsed_us(&begin);
+
+            for (int i = 0; i < n; i++)
+            {
+                max_diff = fmax(max_diff, fabs(x[i] - x_ref[i]));
+            }
+        }
+        if (factored) printf("%d,%d,%ld,%ld,%.3e\n", n, steps, refactor_us, update_us, max_diff);
+
+        lu_update_free(&F);
+        free(A);
+        free(L);
+        free(U);
+        free(b);
+        free(x);
+        free(y);
+        free(x_ref);
+        free(row);
+    }
+
+    return 0;
+#endif
+}
+
+/**
+ * Factorizes a copy of the nxn matrix A with decompose() and prepares room for
+ * up to max_rank rank-1 updates.
+ * Returns 0 on success and -1 if decompose() hit a zero pivot.
+ */
+int lu_update_init(struct lu_update* F, int n, double A[][n], int max_rank, int precision)
+{
+    if (max_rank < 1) max_rank = 1;
+    F->n = n;
+    F->precision = precision;
+    F->max_rank = max_rank;
+    F->rank = 0;
+    F->refactor_count = 0;
+    F->A = malloc(sizeof(double) * n * n);
+    F->L = malloc(sizeof(double) * n * n);
+    F->U = malloc(sizeof(double) * n * n);
+    F->V = malloc(sizeof(double) * max_rank * n);
+    F->Z = malloc(sizeof(double) * max_rank * n);
+    F->S = malloc(sizeof(double) * max_rank * max_rank);
+    F->S_lu = malloc(sizeof(double) * max_rank * max_rank);
+    F->S_piv = malloc(sizeof(int) * max_rank);
+    memcpy(F->A, A, sizeof(double) * n * n);
+
+    int ret = lu_update_refactor(F);
+    F->refactor_count = 0;
+    return ret;
+}
+
+void lu_update_free(struct lu_update* F)
+{
+    free(F->A);
+    free(F->L);
+    free(F->U);
+    free(F->V);
+    free(F->Z);
+    free(F->S);
+    free(F->S_lu);
+    free(F->S_piv);
+}
+
+/**
+ * Drops the accumulated terms and factorizes the current matrix from scratch.
+ */
+int lu_update_refactor(struct lu_update* F)
+{
+    int n = F->n;
+    double (*A)[n] = (double (*)[n])F->A;
+    double (*L)[n] = (double (*)[n])F->L;
+    double (*U)[n] = (double (*)[n])F->U;
+
+    // decompose() only writes the triangles, the rest must be zero
+    memset(L, 0, sizeof(double) * n * n);
+    memset(U, 0, sizeof(double) * n * n);
+    decompose(n, A, L, U, F->precision);
+    F->rank = 0;
+    F->refactor_count++;
+
+    for (int i = 0; i < n; i++)
+    {
+        if (L[i][i] == 0 || !isfinite(L[i][i]))
+        {
+            fprintf(stderr, "ERROR: zero pivot at row %d.. decompose() needs a reordered matrix.\n", i);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * A += u * v'
+ * Costs one solve with the base factors, O(n^2), plus O(rank * n).
+ */
+int lu_update_rank1(struct lu_update* F, const double* u, const double* v)
+{
+    int n = F->n;
+    double (*A)[n] = (double (*)[n])F->A;
+    for (int i = 0; i < n; i++)
+    {
+        if (u[i] == 0) continue;
+        for (int j = 0; j < n; j++)
+        {
+            A[i][j] += u[i] * v[j];
+        }
+    }
+
+    if (F->rank == F->max_rank)
+    {
+        return lu_update_refactor(F);
+    }
+
+    int r = F->rank;
+    int m = F->max_rank;
+    double (*V)[n] = (double (*)[n])F->V;
+    double (*Z)[n] = (double (*)[n])F->Z;
+    double (*S)[m] = (double (*)[m])F->S;
+    memcpy(V[r], v, sizeof(double) * n);
+    base_solve(F, u, Z[r]);
+
+    // grow S = I + V'Z by one row and one column
+    for (int a = 0; a <= r; a++)
+    {
+        double s_ar = 0, s_ra = 0;
+        for (int i = 0; i < n; i++)
+        {
+            s_ar += V[a][i] * Z[r][i];
+            s_ra += V[r][i] * Z[a][i];
+        }
+        S[a][r] = s_ar + (a == r);
+        S[r][a] = s_ra + (a == r);
+    }
+    F->rank++;
+
+    if (!factorize_capacitance(F))
+    {
+        debug_message("Capacitance matrix is ill-conditioned at rank %d.. refactoring\n", F->rank);
+        return lu_update_refactor(F);
+    }
+    return 0;
+}
+
+/**
+ * A += U * V' for nxk matrices U and V.
+ */
+int lu_update_rank_k(struct lu_update* F, int k, double U[][k], double V[][k])
+{
+    int n = F->n;
+    double u[n], v[n];
+    for (int r = 0; r < k; r++)
+    {
+        for (int i = 0; i < n; i++)
+        {
+            u[i] = U[i][r];
+            v[i] = V[i][r];
+        }
+        int ret = lu_update_rank1(F, u, v);
+        if (ret != 0) return ret;
+    }
+    return 0;
+}
+
+/**
+ * Replaces row `row` of A with a: A += e_row * (a - A[row])'
+ */
+int lu_update_replace_row(struct lu_update* F, int row, const double* a)
+{
+    int n = F->n;
+    double (*A)[n] = (double (*)[n])F->A;
+    double u[n], v[n];
+    for (int i = 0; i < n; i++)
+    {
+        u[i] = (i == row);
+        v[i] = a[i] - A[row][i];
+    }
+    return lu_update_rank1(F, u, v);
+}
+
+/**
+ * Replaces column `col` of A with a: A += (a - A[:, col]) * e_col'
+ */
+int lu_update_replace_col(struct lu_update* F, int col, const double* a)
+{
+    int n = F->n;
+    double (*A)[n] = (double (*)[n])F->A;
+    double u[n], v[n];
+    for (int i = 0; i < n; i++)
+    {
+        u[i] = a[i] - A[i][col];
+        v[i] = (i == col);
+    }
+    return lu_update_rank1(F, u, v);
+}
+
+/**
+ * Solves A x = b for the current A.
+ * If the Woodbury correction leaves a large residual, A is factorized again and
+ * the system is solved with the new factors.
+ */
+int lu_update_solve(struct lu_update* F, const double* b, double* x)
+{
+    int n = F->n;
+    base_solve(F, b, x);
+    if (F->rank == 0) return 0;
+
+    // x = y - Z * S^-1 * V'y
+    double (*V)[n] = (double (*)[n])F->V;
+    double (*Z)[n] = (double (*)[n])F->Z;
+    double t[F->rank];
+    for (int r = 0; r < F->rank; r++)
+    {
+        t[r] = 0;
+        for (int i = 0; i < n; i++)
+        {
+            t[r] += V[r][i] * x[i];
+        }
+    }
+    capacitance_solve(F, t);
+    for (int r = 0; r < F->rank; r++)
+    {
+        for (int i = 0; i < n; i++)
+        {
+            x[i] -= Z[r][i] * t[r];
+        }
+    }
+
+    if (F->precision == -1 && relative_residual(F, b, x) > RESIDUAL_TOLERANCE)
+    {
+        debug_message("Residual too large after %d updates.. refactoring\n", F->rank);
+        int ret = lu_update_refactor(F);
+        if (ret != 0) return ret;
+        base_solve(F, b, x);
+    }
+    return 0;
+}
+
+/**
+ * x = A0^-1 b with the factors from decompose()
+ */
+static void base_solve(struct lu_update* F, const double* b, double* x)
+{
+    int n = F->n;
+    double y[n], bb[n];
+    memcpy(bb, b, sizeof(bb));
+    forward_substitution(n, (double (*)[n])F->L, y, bb);
+    backward_substitution(n, (double (*)[n])F->U, x, y);
+}
+
+/**
+ * Factorizes S with partial pivoting into S_lu. Returns false if a pivot is
+ * negligible compared to the entries of S, in which case the correction would
+ * amplify rounding errors.
+ */
+static bool factorize_capacitance(struct lu_update* F)
+{
+    int k = F->rank;
+    int m = F->max_rank;
+    double (*S)[m] = (double (*)[m])F->S;
+    double (*T)[m] = (double (*)[m])F->S_lu;
+
+    double max_entry = 0;
+    for (int i = 0; i < k; i++)
+    {
+        for (int j = 0; j < k; j++)
+        {
+            T[i][j] = S[i][j];
+            max_entry = fmax(max_entry, fabs(S[i][j]));
+        }
+    }
+
+    for (int c = 0; c < k; c++)
+    {
+        int p = c;
+        for (int i = c + 1; i < k; i++)
+        {
+            if (fabs(T[p][c]) < fabs(T[i][c])) p = i;
+        }
+        F->S_piv[c] = p;
+        if (fabs(T[p][c]) <= CAPACITANCE_PIVOT_TOLERANCE * max_entry) return false;
+        for (int j = 0; j < k; j++)
+        {
+            double t = T[c][j];
+            T[c][j] = T[p][j];
+            T[p][j] = t;
+        }
+        for (int i = c + 1; i < k; i++)
+        {
+            T[i][c] /= T[c][c];
+            for (int j = c + 1; j < k; j++)
+            {
+                T[i][j] -= T[i][c] * T[c][j];
+            }
+        }
+    }
+    return true;
+}
+
+/**
+ * t = S^-1 t
+ */
+static void capacitance_solve(struct lu_update* F, double* t)
+{
+    int k = F->rank;
+    int m = F->max_rank;
+    double (*T)[m] = (double (*)[m])F->S_lu;
+
+    for (int c = 0; c < k; c++)
+    {
+        int p = F->S_piv[c];
+        double s = t[c];
+        t[c] = t[p];
+        t[p] = s;
+    }
+    for (int i = 0; i < k; i++)
+    {
+        for (int j = 0; j < i; j++) t[i] -= T[i][j] * t[j];
+    }
+    for (int i = k - 1; i >= 0; i--)
+    {
+        for (int j = i + 1; j < k; j++) t[i] -= T[i][j] * t[j];
+        t[i] /= T[i][i];
+    }
+}
+
+/**
+ * ||b - A x||_inf / (||A||_inf * ||x||_inf)
+ */
+static double relative_residual(struct lu_update* F, const double* b, const double* x)
+{
+    int n = F->n;
+    double (*A)[n] = (double (*)[n])F->A;
+    double max_r = 0, norm_a = 0, norm_x = 0;
+    for (int i = 0; i < n; i++)
+    {
+        double r = b[i], row_sum = 0;
+        for (int j = 0; j < n; j++)
+        {
+            r -= A[i][j] * x[j];
+            row_sum += fabs(A[i][j]);
+        }
+        max_r = fmax(max_r, fabs(r));
+        norm_a = fmax(norm_a, row_sum);
+        norm_x = fmax(norm_x, fabs(x[i]));
+    }
+    if (norm_a == 0 || norm_x == 0) return max_r;
+    return max_r / (norm_a * norm_x);
+}
+
+#ifndef TEST
+static long get_elapsed_us(struct timeval* begin)
+{
+    struct timeval end;
+    gettimeofday(&end, 0);
+    long seconds = end.tv_sec - begin->tv_sec;
+    long microseconds = end.tv_usec - begin->tv_usec;
+    long elapsed = seconds * 1e6 + microseconds;
+
+    return elapsed;
+}
+#endif
+
+static void debug_message(const char* message, ...)
+{
+#ifdef PRINTDEBUG
+    va_list args;
+    va_start(args, message);
+    vprintf(message, args);
+    va_end(args);
+#endif
+}
@@ -0,0 +1,119 @@
+// vim: noai:ts=4:sw=4
+
+/*
+recipe:
+> `gcc --std=c99 -O3 -march=native -DNOMAIN crout.c measurematmul.c -o measurematmul -lm`
+> run: `./measurematmul [--max-n <n>]`
+
+Strassen-Winograd matmul_strassen() against the classic product
+(matmul_strassen() with a crossover above n, i.e. only the blocked kernel).
+The first table varies the crossover at the largest n to find where the
+recursion starts to pay off, the second one compares both at growing and
+odd sizes and for a rectangular product. err is max|C - C_classic| / max|C_classic|.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <sys/time.h>
+
+extern void matmul_strassen(int m, int n, int p, double A[][n], double B[][p], double C[][p], int crossover, double* work);
+extern size_t strassen_workspace_size(int m, int n, int p, int crossover);
+
+long get_elapsed_us(struct timeval *begin)
+{
+    struct timeval end;
+    gettimeofday(&end, 0);
+    long seconds = end.tv_sec - begin->tv_sec;
+    long microseconds = end.tv_usec - begin->tv_usec;
+    long elapsed = seconds * 1e6 + microseconds;
+
+    return elapsed;
+}
+
+/**
+ * Times C = A * B for an m x n times n x p product; the workspace is allocated
+ * outside the timed region. Returns the time in microseconds.
+ */
+long time_product(int m, int n, int p, double A[][n], double B[][p], double C[][p], int crossover)
+{
+    size_t size = strassen_workspace_size(m, n, p, crossover);
+    double* work = malloc(sizeof(double) * (size > 0 ? size : 1));
+    memset(C, 0, sizeof(double) * m * p);
+
+    struct timeval begin;
+    gettimeofday(&begin, 0);
+    matmul_strassen(m, n, p, A, B, C, crossover, work);
+    long elapsed = get_elapsed_us(&begin);
+
+    free(work);
+    return elapsed;
+}
+
+double relative_error(int m, int p, double C[][p], double R[][p])
+{
+    double max_diff = 0, max_r = 0;
+    for (int i = 0; i < m; i++)
+    {
+        for (int j = 0; j < p; j++)
+        {
+            max_diff = fmax(max_diff, fabs(C[i][j] - R[i][j]));
+            max_r = fmax(max_r, fabs(R[i][j]));
+        }
+    }
+    return max_diff / max_r;
+}
+
+void compare(int m, int n, int p, int crossover)
+{
+    double (*A)[n] = malloc(sizeof(double) * m * n);
+    double (*B)[p] = malloc(sizeof(double) * n * p);
+    double (*C)[p] = malloc(sizeof(double) * m * p);
+    double (*R)[p] = malloc(sizeof(double) * m * p);
+    for (int i = 0; i < m; i++)
+        for (int j = 0; j < n; j++)
+            A[i][j] = (double)rand() / RAND_MAX - 0.5;
+    for (int i = 0; i < n; i++)
+        for (int j = 0; j < p; j++)
+            B[i][j] = (double)rand() / RAND_MAX - 0.5;
+
+    long classic_us = time_product(m, n, p, A, B, R, n + m + p);
+    long strassen_us = time_product(m, n, p, A, B, C, crossover);
+    printf("%d,%d,%d,%d,%ld,%ld,%.2f,%.3e\n", m, n, p, crossover, classic_us, strassen_us,
+        (double)classic_us / strassen_us, relative_error(m, p, C, R));
+    fflush(stdout);
+
+    free(A);
+    free(B);
+    free(C);
+    free(R);
+}
+
+int main(int argc, char** argv)
+{
+    int max_n = 2048;
+    for (int arg_i = 1; arg_i < argc; arg_i++)
+    {
+        if (strcmp(argv[arg_i], "--max-n") == 0 && arg_i + 1 < argc)
+            max_n = atoi(argv[++arg_i]);
+        else
+            printf("WARNING: unrecognized option %s\n", argv[arg_i]);
+    }
+
+    printf("m,n,p,crossover,classic_us,strassen_us,speedup,err\n");
+    for (int crossover = 32; crossover <= max_n / 2; crossover *= 2)
+    {
+        compare(max_n, max_n, max_n, crossover);
+    }
+
+    printf("\nm,n,p,crossover,classic_us,strassen_us,speedup,err\n");
+    for (int n = 256; n <= max_n; n *= 2)
+    {
+        compare(n, n, n, 128);
+        compare(n - 1, n - 1, n - 1, 128);
+    }
+    compare(max_n / 2 + 3, max_n - 5, max_n / 4 * 3 + 1, 128);
+
+    return 0;
+}
@@ -0,0 +1,564 @@
+// vim: noai:ts=4:sw=4
+
+/*
+recipe:
+> `mpicc --std=c99 -O3 -DNOMAIN crout.c mpilu.c -o mpilu -lm`
+> run on one box over shared memory: `mpirun -np 4 ./mpilu <n> <nb>`
+  (add `--oversubscribe` with Open MPI when there are fewer cores than processes)
+
+Distributed-memory LU decomposition with partial pivoting and solve.
+The nxn matrix is laid out 2D block-cyclic on a Pr x Pc process grid: block
+(I, J) of size nb x nb lives on process (I mod Pr, J mod Pc). For every block
+column k the owning process column factorizes the panel, the panel and the
+pivots are broadcast along process rows, the U block row is broadcast down
+process columns, and every process updates its part of the trailing matrix
+with matmul_general() from crout.c. The right hand side is kept replicated
+and the triangular solves reuse forward_substitution()/backward_substitution().
+
+main() runs a strong scaling sweep: the same problem is solved on the first
+1, 2, 4, ... processes of MPI_COMM_WORLD and the speedup over one process is
+reported.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+#include <mpi.h>
+
+extern void forward_substitution(int n, double L[][n], double y[n], double b[n]);
+extern void backward_substitution(int n, double U[][n], double x[n], double y[n]);
+extern void matmul_general(int m, int n, int p, double A[][n], double B[][p], double C[][p]);
+
+/** process grid **/
+struct grid
+{
+    MPI_Comm comm;      // all processes of the grid; rank = myrow * npcol + mycol
+    MPI_Comm row_comm;  // processes in my process row; rank = mycol
+    MPI_Comm col_comm;  // processes in my process column; rank = myrow
+    int nprow, npcol;
+    int myrow, mycol;
+};
+
+/** local part of a block-cyclic nxn matrix, row-major mloc x nloc **/
+struct dist_matrix
+{
+    int n, nb;
+    int mloc, nloc;
+    double* a;
+};
+
+void grid_init(struct grid* G, MPI_Comm comm);
+void grid_free(struct grid* G);
+void dist_matrix_init(struct dist_matrix* M, struct grid* G, int n, int nb);
+void dist_matrix_free(struct dist_matrix* M);
+int dist_lu(struct grid* G, struct dist_matrix* M, int* ipiv);
+void dist_lu_solve(struct grid* G, struct dist_matrix* M, const int* ipiv, double* b);
+
+static int numroc(int n, int nb, int iproc, int nprocs);
+static int owner(int g, int nb, int nprocs);
+static int local_index(int g, int nb, int nprocs);
+static int global_index(int l, int nb, int iproc, int nprocs);
+static void swap_rows(struct grid* G, struct dist_matrix* M, int gi, int gp, int lc0, int lc1);
+static double entry(int gi, int gj);
+
+int main(int argc, char** argv)
+{
+    MPI_Init(&argc, &argv);
+    int rank, size;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+    /** input: parse command line arguments **/
+    if (argc < 3)
+    {
+        if (rank == 0) printf("ERROR: usage: mpilu <n> <nb>\n");
+        MPI_Finalize();
+        return -1;
+    }
+    int n = atoi(argv[1]);
+    int nb = atoi(argv[2]);
+    if (n < 1 || nb < 1)
+    {
+        if (rank == 0) printf("ERROR: n and nb must be positive\n");
+        MPI_Finalize();
+        return -1;
+    }
+
+    /** run: the same system on 1, 2, 4, ..., size processes **/
+    if (rank == 0) printf("np,grid,n,nb,seconds,gflops,speedup,efficiency,max_error\n");
+    double base_seconds = 0;
+    for (int p = 1; ; p = (p * 2 < size) ? p * 2 : size)
+    {
+        MPI_Comm comm;
+        MPI_Comm_split(MPI_COMM_WORLD, rank < p ? 0 : MPI_UNDEFINED, rank, &comm);
+        if (comm != MPI_COMM_NULL)
+        {
+            struct grid G;
+            struct dist_matrix M;
+            grid_init(&G, comm);
+            dist_matrix_init(&M, &G, n, nb);
+
+            // b = A * ones, so the solution is all ones
+            double* partial = calloc(n, sizeof(double));
+            double* b = malloc(sizeof(double) * n);
+            int* ipiv = malloc(sizeof(int) * n);
+            double (*A)[M.nloc] = (double (*)[M.nloc])M.a;
+            for (int li = 0; li < M.mloc; li++)
+            {
+                int gi = global_index(li, nb, G.myrow, G.nprow);
+                for (int lj = 0; lj < M.nloc; lj++)
+                {
+                    partial[gi] += A[li][lj];
+                }
+            }
+            MPI_Allreduce(partial, b, n, MPI_DOUBLE, MPI_SUM, comm);
+
+            MPI_Barrier(comm);
+            double start = MPI_Wtime();
+            int ret = dist_lu(&G, &M, ipiv);
+            if (ret == 0) dist_lu_solve(&G, &M, ipiv, b);
+            MPI_Barrier(comm);
+            double seconds = MPI_Wtime() - start;
+
+            double max_error = 0;
+            for (int i = 0; i < n; i++)
+            {
+                max_error = fmax(max_error, fabs(b[i] - 1.0));
+            }
+            if (p == 1) base_seconds = seconds;
+            if (rank == 0)
+            {
+                if (ret != 0) printf("ERROR: matrix is singular\n");
+                double gflops = 2.0 / 3.0 * n * (double)n * n / seconds * 1e-9;
+                printf("%d,%dx%d,%d,%d,%.6f,%.3f,%.2f,%.2f,%.3e\n", p, G.nprow, G.npcol, n, nb,
+                    seconds, gflops, base_seconds / seconds, base_seconds / seconds / p, max_error);
+                fflush(stdout);
+            }
+
+            free(partial);
+            free(b);
+            free(ipiv);
+            dist_matrix_free(&M);
+            grid_free(&G);
+            MPI_Comm_free(&comm);
+        }
+        // the base time is only known by the single process run
+        MPI_Bcast(&base_seconds, 1, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+
+        if (p == size) break;
+    }
+
+    MPI_Finalize();
+    return 0;
+}
+
+/**
+ * Arranges the processes of comm into the most square Pr x Pc grid with Pr <= Pc.
+ */
+void grid_init(struct grid* G, MPI_Comm comm)
+{
+    int rank, size;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+
+    G->comm = comm;
+    G->nprow = (int)sqrt((double)size);
+    while (size % G->nprow != 0) G->nprow--;
+    G->npcol = size / G->nprow;
+    G->myrow = rank / G->npcol;
+    G->mycol = rank % G->npcol;
+    MPI_Comm_split(comm, G->myrow, G->mycol, &G->row_comm);
+    MPI_Comm_split(comm, G->mycol, G->myrow, &G->col_comm);
+}
+
+void grid_free(struct grid* G)
+{
+    MPI_Comm_free(&G->row_comm);
+    MPI_Comm_free(&G->col_comm);
+}
+
+/**
+ * Allocates this process' blocks of the nxn test matrix and fills them in.
+ * Every entry is a function of its global position, so no data has to be scattered.
+ */
+void dist_matrix_init(struct dist_matrix* M, struct grid* G, int n, int nb)
+{
+    M->n = n;
+    M->nb = nb;
+    M->mloc = numroc(n, nb, G->myrow, G->nprow);
+    M->nloc = numroc(n, nb, G->mycol, G->npcol);
+    M->a = malloc(sizeof(double) * (M->mloc * M->nloc + 1));
+
+    double (*A)[M->nloc] = (double (*)[M->nloc])M->a;
+    for (int li = 0; li < M->mloc; li++)
+    {
+        int gi = global_index(li, nb, G->myrow, G->nprow);
+        for (int lj = 0; lj < M->nloc; lj++)
+        {
+            A[li][lj] = entry(gi, global_index(lj, nb, G->mycol, G->npcol));
+        }
+    }
+}
+
+void dist_matrix_free(struct dist_matrix* M)
+{
+    free(M->a);
+    M->a = NULL;
+}
+
+/**
+ * Factorizes the distributed matrix in place into P*A = L*U (L unit lower triangular).
+ * On return every process holds all n pivots: ipiv[i] is the global row that was
+ * interchanged with row i, applied in increasing order of i.
+ * Returns 0 on success and -1 on every process if a zero pivot was found.
+ */
+int dist_lu(struct grid* G, struct dist_matrix* M, int* ipiv)
+{
+    int n = M->n, nb = M->nb, mloc = M->mloc, nloc = M->nloc;
+    double (*A)[nloc] = (double (*)[nloc])M->a;
+    int singular = 0;
+
+    double* prow = malloc(sizeof(double) * nb);
+    double (*Lp)[nb] = malloc(sizeof(double) * (mloc * nb + 1));
+    double* Ub = malloc(sizeof(double) * (nb * nloc + 1));
+    double (*Lneg)[nb] = malloc(sizeof(double) * nb * nb);
+    double* Cstrip = malloc(sizeof(double) * (nb * nloc + 1));
+
+    for (int c0 = 0; c0 < n; c0 += nb)
+    {
+        int k = c0 / nb;
+        int w = (c0 + nb < n) ? nb : n - c0;
+        int c1 = c0 + w;
+        int pr_k = k % G->nprow;
+        int pc_k = k % G->npcol;
+        int lcp = local_index(c0, nb, G->npcol);    // local column of the panel on pc_k
+
+        // 1. panel factorization within process column pc_k
+        if (G->mycol == pc_k)
+        {
+            for (int gj = c0; gj < c1; gj++)
+            {
+                int lj = lcp + (gj - c0);
+                struct { double value; int index; } local_max = { -1.0, INT_MAX }, max;
+                for (int li = numroc(gj, nb, G->myrow, G->nprow); li < mloc; li++)
+                {
+                    if (local_max.value < fabs(A[li][lj]))
+                    {
+                        local_max.value = fabs(A[li][lj]);
+                        local_max.index = global_index(li, nb, G->myrow, G->nprow);
+                    }
+                }
+                // ties go to the lowest row, i.e. the first max like eliminate()
+                MPI_Allreduce(&local_max, &max, 1, MPI_DOUBLE_INT, MPI_MAXLOC, G->col_comm);
+                ipiv[gj] = max.index;
+                swap_rows(G, M, gj, max.index, lcp, lcp + w);
+                if (max.value == 0)
+                {
+                    singular = 1;
+                    continue;
+                }
+
+                int owner_row = owner(gj, nb, G->nprow);
+                if (G->myrow == owner_row)
+                {
+                    memcpy(prow, &A[local_index(gj, nb, G->nprow)][lcp], sizeof(double) * w);
+                }
+                MPI_Bcast(prow, w, MPI_DOUBLE, owner_row, G->col_comm);
+
+                double pivot = prow[gj - c0];
+                for (int li = numroc(gj + 1, nb, G->myrow, G->nprow); li < mloc; li++)
+                {
+                    double multiplier = A[li][lj] / pivot;
+                    A[li][lj] = multiplier;
+                    for (int t = gj - c0 + 1; t < w; t++)
+                    {
+                        A[li][lcp + t] -= multiplier * prow[t];
+                    }
+                }
+            }
+        }
+
+        // 2. everybody learns the pivots, 3. and applies them to the rest of the rows
+        MPI_Bcast(&ipiv[c0], w, MPI_INT, pc_k, G->row_comm);
+        for (int gj = c0; gj < c1; gj++)
+        {
+            if (G->mycol == pc_k)
+            {
+                swap_rows(G, M, gj, ipiv[gj], 0, lcp);
+                swap_rows(G, M, gj, ipiv[gj], lcp + w, nloc);
+            }
+            else
+            {
+                swap_rows(G, M, gj, ipiv[gj], 0, nloc);
+            }
+        }
+
+        // 4. broadcast the L panel along the process rows
+        if (G->mycol == pc_k)
+        {
+            for (int li = 0; li < mloc; li++)
+            {
+                memcpy(Lp[li], &A[li][lcp], sizeof(double) * w);
+            }
+        }
+        MPI_Bcast(Lp, mloc * nb, MPI_DOUBLE, pc_k, G->row_comm);
+
+        // 5. U block row = L_kk^-1 * A_kj, broadcast down the process columns
+        int lt = numroc(c1, nb, G->mycol, G->npcol);
+        int ntr = nloc - lt;
+        double (*U)[ntr > 0 ? ntr : 1] = (double (*)[ntr > 0 ? ntr : 1])Ub;
+        if (ntr > 0)
+        {
+            if (G->myrow == pr_k)
+            {
+                int lrk = local_index(c0, nb, G->nprow);
+                for (int r = 0; r < w; r++)
+                {
+                    for (int t = 0; t < r; t++)
+                    {
+                        double l = Lp[lrk + r][t];
+                        for (int lj = lt; lj < nloc; lj++)
+                        {
+                            A[lrk + r][lj] -= l * A[lrk + t][lj];
+                        }
+                    }
+                    memcpy(U[r], &A[lrk + r][lt], sizeof(double) * ntr);
+                }
+            }
+            MPI_Bcast(Ub, w * ntr, MPI_DOUBLE, pr_k, G->col_comm);
+        }
+
+        // 6. trailing update A_ij -= L_ik * U_kj, a strip of at most nb local rows at a time
+        int lr_t = numroc(c1, nb, G->myrow, G->nprow);
+        if (ntr > 0)
+        {
+            for (int s0 = lr_t; s0 < mloc; s0 += nb)
+            {
+                int rows = (s0 + nb < mloc) ? nb : mloc - s0;
+                double (*L)[w] = (double (*)[w])Lneg;
+                double (*C)[ntr] = (double (*)[ntr])Cstrip;
+                for (int r = 0; r < rows; r++)
+                {
+                    for (int t = 0; t < w; t++)
+                    {
+                        L[r][t] = -Lp[s0 + r][t];
+                    }
+                    memcpy(C[r], &A[s0 + r][lt], sizeof(double) * ntr);
+                }
+                matmul_general(rows, w, ntr, L, U, C);
+                for (int r = 0; r < rows; r++)
+                {
+                    memcpy(&A[s0 + r][lt], C[r], sizeof(double) * ntr);
+                }
+            }
+        }
+    }
+
+    free(prow);
+    free(Lp);
+    free(Ub);
+    free(Lneg);
+    free(Cstrip);
+
+    int any_singular;
+    MPI_Allreduce(&singular, &any_singular, 1, MPI_INT, MPI_MAX, G->comm);
+    return any_singular ? -1 : 0;
+}
+
+/**
+ * Solves A x = b with the output of dist_lu(). b is replicated on every process
+ * and is overwritten by x on every process.
+ * Block by block, the partial sums of the off diagonal blocks are reduced onto the
+ * owner of the diagonal block, which solves it and broadcasts the result.
+ */
+void dist_lu_solve(struct grid* G, struct dist_matrix* M, const int* ipiv, double* b)
+{
+    int n = M->n, nb = M->nb, mloc = M->mloc, nloc = M->nloc;
+    double (*A)[nloc] = (double (*)[nloc])M->a;
+    double* acc = calloc(n, sizeof(double));
+    double* sum = malloc(sizeof(double) * nb);
+    double* rhs = malloc(sizeof(double) * nb);
+    double (*T)[nb] = malloc(sizeof(double) * nb * nb);
+
+    for (int i = 0; i < n; i++)
+    {
+        double t = b[i];
+        b[i] = b[ipiv[i]];
+        b[ipiv[i]] = t;
+    }
+
+    // L y = Pb
+    for (int c0 = 0; c0 < n; c0 += nb)
+    {
+        int k = c0 / nb;
+        int w = (c0 + nb < n) ? nb : n - c0;
+        int pr_k = k % G->nprow;
+        int pc_k = k % G->npcol;
+        if (G->myrow == pr_k)
+        {
+            MPI_Reduce(&acc[c0], sum, w, MPI_DOUBLE, MPI_SUM, pc_k, G->row_comm);
+            if (G->mycol == pc_k)
+            {
+                int lrk = local_index(c0, nb, G->nprow);
+                int lck = local_index(c0, nb, G->npcol);
+                double (*L)[w] = (double (*)[w])T;
+                for (int r = 0; r < w; r++)
+                {
+                    for (int t = 0; t < w; t++)
+                    {
+                        L[r][t] = (t < r) ? A[lrk + r][lck + t] : (t == r) ? 1.0 : 0.0;
+                    }
+                    rhs[r] = b[c0 + r] - sum[r];
+                }
+                forward_substitution(w, L, &b[c0], rhs);
+            }
+        }
+        MPI_Bcast(&b[c0], w, MPI_DOUBLE, pr_k * G->npcol + pc_k, G->comm);
+
+        if (G->mycol == pc_k)
+        {
+            int lck = local_index(c0, nb, G->npcol);
+            for (int li = numroc(c0 + w, nb, G->myrow, G->nprow); li < mloc; li++)
+            {
+                double s = 0;
+                for (int t = 0; t < w; t++)
+                {
+                    s += A[li][lck + t] * b[c0 + t];
+                }
+                acc[global_index(li, nb, G->myrow, G->nprow)] += s;
+            }
+        }
+    }
+
+    // U x = y
+    memset(acc, 0, sizeof(double) * n);
+    for (int c0 = ((n - 1) / nb) * nb; c0 >= 0; c0 -= nb)
+    {
+        int k = c0 / nb;
+        int w = (c0 + nb < n) ? nb : n - c0;
+        int pr_k = k % G->nprow;
+        int pc_k = k % G->npcol;
+        if (G->myrow == pr_k)
+        {
+            MPI_Reduce(&acc[c0], sum, w, MPI_DOUBLE, MPI_SUM, pc_k, G->row_comm);
+            if (G->mycol == pc_k)
+            {
+                // backward_substitution() expects a unit diagonal, so scale the rows
+                int lrk = local_index(c0, nb, G->nprow);
+                int lck = local_index(c0, nb, G->npcol);
+                double (*U)[w] = (double (*)[w])T;
+                for (int r = 0; r < w; r++)
+                {
+                    double d = A[lrk + r][lck + r];
+                    for (int t = 0; t < w; t++)
+                    {
+                        U[r][t] = (t >= r) ? A[lrk + r][lck + t] / d : 0.0;
+                    }
+                    rhs[r] = (b[c0 + r] - sum[r]) / d;
+                }
+                backward_substitution(w, U, &b[c0], rhs);
+            }
+        }
+        MPI_Bcast(&b[c0], w, MPI_DOUBLE, pr_k * G->npcol + pc_k, G->comm);
+
+        if (G->mycol == pc_k)
+        {
+            int lck = local_index(c0, nb, G->npcol);
+            for (int li = 0; li < numroc(c0, nb, G->myrow, G->nprow); li++)
+            {
+                double s = 0;
+                for (int t = 0; t < w; t++)
+                {
+                    s += A[li][lck + t] * b[c0 + t];
+                }
+                acc[global_index(li, nb, G->myrow, G->nprow)] += s;
+            }
+        }
+    }
+
+    free(acc);
+    free(sum);
+    free(rhs);
+    free(T);
+}
+
+/**
+ * Number of the first n global rows (or columns) owned by process iproc.
+ */
+static int numroc(int n, int nb, int iproc, int nprocs)
+{
+    int nblocks = n / nb;
+    int count = (nblocks / nprocs) * nb;
+    int extra = nblocks % nprocs;
+    if (iproc < extra)
+        count += nb;
+    else if (iproc == extra)
+        count += n % nb;
+    return count;
+}
+
+static int owner(int g, int nb, int nprocs)
+{
+    return (g / nb) % nprocs;
+}
+
+static int local_index(int g, int nb, int nprocs)
+{
+    return (g / (nb * nprocs)) * nb + g % nb;
+}
+
+static int global_index(int l, int nb, int iproc, int nprocs)
+{
+    return ((l / nb) * nprocs + iproc) * nb + l % nb;
+}
+
+/**
+ * Swaps global rows gi and gp over local columns lc0..lc1-1.
+ * Called by every process of a process column; only the owners of the two rows act.
+ */
+static void swap_rows(struct grid* G, struct dist_matrix* M, int gi, int gp, int lc0, int lc1)
+{
+    if (gi == gp || lc1 <= lc0) return;
+
+    double (*A)[M->nloc] = (double (*)[M->nloc])M->a;
+    int nb = M->nb;
+    int oi = owner(gi, nb, G->nprow);
+    int op = owner(gp, nb, G->nprow);
+    int width = lc1 - lc0;
+
+    if (oi == op)
+    {
+        if (G->myrow != oi) return;
+        double* ri = &A[local_index(gi, nb, G->nprow)][lc0];
+        double* rp = &A[local_index(gp, nb, G->nprow)][lc0];
+        for (int c = 0; c < width; c++)
+        {
+            double t = ri[c];
+            ri[c] = rp[c];
+            rp[c] = t;
+        }
+    }
+    else if (G->myrow == oi || G->myrow == op)
+    {
+        int mine = (G->myrow == oi) ? gi : gp;
+        int partner = (G->myrow == oi) ? op : oi;
+        MPI_Sendrecv_replace(&A[local_index(mine, nb, G->nprow)][lc0], width, MPI_DOUBLE,
+            partner, 0, partner, 0, G->col_comm, MPI_STATUS_IGNORE);
+    }
+}
+
+/**
+ * Pseudo random entry in [-0.5, 0.5) that only depends on the global position.
+ */
+static double entry(int gi, int gj)
+{
+    unsigned int h = (unsigned int)gi * 2654435761u ^ (unsigned int)gj * 2246822519u;
+    h ^= h >> 15;
+    h *= 2246822519u;
+    h ^= h >> 13;
+    h *= 3266489917u;
+    h ^= h >> 16;
+    return (double)h / 4294967296.0 - 0.5;
+}
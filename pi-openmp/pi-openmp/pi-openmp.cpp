@@ -4,6 +4,7 @@
 #include "pi-openmp.h"
 
 #include <omp.h>
+#include <vector>
 //#include <stdlib.h>
 
 using namespace std;
@@ -11,8 +12,13 @@ using namespace std;
 int main() {
     constexpr int MAX_THREADS = 8;
 	constexpr long steps = 1'000'000'000;
+	// Deterministic mode: the steps are cut into a fixed number of chunks whatever the
+	// thread count, every chunk is summed in order and the partial sums are added by a
+	// fixed pairwise tree, so PI is bit-identical on any number of threads
+	constexpr int chunks = 4096;
 
     const double step = 1.0 / static_cast<double>(steps);
+	double reference = 0.0;	// deterministic PI on one thread
 
 	for (auto j = 1; j <= MAX_THREADS; j++) {
 		std::cout << "Running on " << j << " threads" << std::endl;
@@ -31,6 +37,32 @@ int main() {
 		double pi = step * sum;
 		double delta = omp_get_wtime() - start;
 		printf("PI = %.16g computed in %.4g seconds\n", pi, delta);
+
+		// The same computation with a reproducible sum
+		start = omp_get_wtime();
+		std::vector<double> partial(chunks);
+        #pragma omp parallel for schedule(static)
+		for (int c = 0; c < chunks; c++) {
+			long long begin = c * static_cast<long long>(steps) / chunks;
+			long long end = (c + 1) * static_cast<long long>(steps) / chunks;
+			double s = 0.0;
+			for (long long i = begin; i < end; i++) {
+				double xi = (i + 0.5) * step;
+				s += 4.0 / (1.0 + xi * xi);
+			}
+			partial[c] = s;
+		}
+		for (int width = 1; width < chunks; width *= 2) {
+			for (int c = 0; c + width < chunks; c += 2 * width) {
+				partial[c] += partial[c + width];
+			}
+		}
+		double pi_deterministic = step * partial[0];
+		double delta_deterministic = omp_get_wtime() - start;
+		if (j == 1) reference = pi_deterministic;
+		printf("PI = %.16g computed in %.4g seconds (deterministic, %+.1f%% time, %s)\n",
+			pi_deterministic, delta_deterministic, 100.0 * (delta_deterministic / delta - 1.0),
+			pi_deterministic == reference ? "bit-identical" : "differs");
 	}
 
 	return 0;
@@ -0,0 +1,513 @@
+// vim: noai:ts=4:sw=4
+
+/*
+recipe:
+> `gcc --std=c99 -O3 -march=native -DNOMAIN -DHIDEDUP gausselim.c crout.c reclu.c -o reclu -lm`
+> run: `./reclu [--max-n <n>] [--max-ref-n <n>]`
+> define TEST macro for running tests: `gcc --std=c99 -O2 -DNOMAIN -DHIDEDUP -DTEST gausselim.c crout.c reclu.c -o reclu -lm`
+
+Recursive, cache-oblivious LU decomposition with partial pivoting.
+The columns are split in halves: factorize the left half, apply its row
+interchanges to the right half, solve for the U block with a recursive
+triangular solve, update the Schur complement with a recursive GEMM and
+factorize it. Every level of the recursion works on blocks half the size of
+the previous one, so some level always fits each cache without a tuned block
+size. The recursion stops at a small base case; the GEMM base case is a 4x8
+register blocked microkernel (AVX2/FMA when the compiler targets it), and the
+LU and triangular solve base cases hand their rank-k updates to it as well.
+
+Pivoting picks the first row with the largest magnitude in the pivot column,
+like eliminate(), and interchanges whole rows. eliminate() may swap the pivot
+row several times while it walks down a column, which is not a plain P*A = L*U,
+so U can differ from what eliminate() leaves in A; the solutions agree.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <math.h>
+#include <sys/time.h>
+#if defined(__AVX2__) && defined(__FMA__)
+#include <immintrin.h>
+#endif
+#ifdef TEST
+#include <assert.h>
+#endif
+
+extern int eliminate(int m, int n, double A[][n], bool do_partial_pivoting, bool augmented_matrix, int precision);
+extern int gauss_elim(int m, int n, double A[][n], double* x, bool do_partial_pivoting, bool augmented_matrix, int precision);
+extern void decompose(int n, double A[][n], double L[][n], double U[][n], int precision);
+
+int rec_lu(int n, double A[][n], int* ipiv);
+void rec_lu_solve(int n, double A[][n], const int* ipiv, double* b);
+
+static int factor(int m, int n, int lda, double A[][lda], int* ipiv);
+static int factor_base(int m, int n, int lda, double A[][lda], int* ipiv);
+static void apply_swaps(int c0, int c1, int lda, double A[][lda], int k0, int k1, const int* ipiv);
+static void trsm_lower_unit(int n, int p, int lda, double L[][lda], int ldb, double B[][ldb]);
+static void gemm_sub(int m, int n, int k, int lda, double A[][lda], int ldb, double B[][ldb], int ldc, double C[][ldc]);
+static void gemm_kernel(int m, int n, int k, int lda, double A[][lda], int ldb, double B[][ldb], int ldc, double C[][ldc]);
+#ifndef TEST
+static long get_elapsed_us(struct timeval* begin);
+#endif
+
+#define BASE_COLUMNS 16     // panel width below which the LU is unblocked
+#define BASE_GROUP 4        // columns (rows) per rank-k update in the LU (TRSM) base case: the kernel's rows
+#define BASE_GEMM 64        // largest dimension handled by the GEMM kernel directly
+#define BASE_TRSM 32
+
+#ifdef TEST
+#define EPSILON 1e-8
+static void test_1()
+{
+    // solutions agree with gauss_elim()
+    int n = 45;
+    double (*A)[n] = malloc(sizeof(double) * n * n);
+    double (*E)[n + 1] = malloc(sizeof(double) * n * (n + 1));
+    double b[n], x[n];
+    int ipiv[n];
+    srand(3);
+    for (int i = 0; i < n; i++)
+    {
+        for (int j = 0; j < n; j++)
+        {
+            A[i][j] = E[i][j] = (double)rand() / RAND_MAX - 0.5;
+        }
+        b[i] = E[i][n] = rand() % 10;
+    }
+
+    assert(rec_lu(n, A, ipiv) == 0);
+    rec_lu_solve(n, A, ipiv, b);
+    assert(gauss_elim(n, n + 1, E, x, true, true, 15) == 0);
+    for (int i = 0; i < n; i++)
+    {
+        assert(fabs(b[i] - x[i]) <= EPSILON);
+    }
+    free(A);
+    free(E);
+}
+
+static void test_2()
+{
+    double A[5][5] = {
+        { 13, 4, 5, 0, 9 },
+        { 33, -2, -7, 8, 0 },
+        { 23, 32, 9, 5, 1 },
+        { 54, 34, 87, 2, 4 },
+        { -5, 6, 7, 8, 9 }
+    };
+    double b[5] = { 101, 3, 7, 66, 10 };
+    int ipiv[5];
+
+    assert(rec_lu(5, A, ipiv) == 0);
+    rec_lu_solve(5, A, ipiv, b);
+    assert(fabs(b[0] - 1.7424) <= 0.0001);
+    assert(fabs(b[1] - -0.0149) <= 0.0001);
+    assert(fabs(b[2] - -0.5640) <= 0.0001);
+    assert(fabs(b[3] - -7.3098) <= 0.0001);
+    assert(fabs(b[4] - 9.0253) <= 0.0001);
+}
+
+static void test_3()
+{
+    // sizes around every base case, with solutions of all ones
+    int sizes[] = { 1, 2, 15, 16, 17, 63, 64, 65, 130, 257 };
+    for (int s = 0; s < sizeof(sizes)/sizeof(int); s++)
+    {
+        int n = sizes[s];
+        double (*M)[n] = malloc(sizeof(double) * n * n);
+        double (*A)[n] = malloc(sizeof(double) * n * n);
+        double b[n];
+        int ipiv[n];
+        for (int i = 0; i < n; i++)
+        {
+            b[i] = 0;
+            for (int j = 0; j < n; j++)
+            {
+                M[i][j] = A[i][j] = (double)rand() / RAND_MAX - 0.5;
+                b[i] += M[i][j];
+            }
+        }
+        assert(rec_lu(n, A, ipiv) == 0);
+        rec_lu_solve(n, A, ipiv, b);
+        for (int i = 0; i < n; i++) assert(fabs(b[i] - 1.0) <= 1e-6);
+        free(M);
+        free(A);
+    }
+}
+#endif
+
+int main(int argc, char** argv)
+{
+#ifdef TEST
+    printf("Running tests\n");
+    test_1();
+    test_2();
+    test_3();
+    printf("Finished running tests\n");
+
+    return 0;
+#else
+    /** input: parse command line arguments **/
+    int max_n = 2048;
+    int max_ref_n = 512;    // eliminate() rounds every operation and is far slower; decompose() runs at every n
+    for (int arg_i = 1; arg_i < argc; arg_i++)
+    {
+        if (strcmp(argv[arg_i], "--max-n") == 0 && arg_i + 1 < argc)
+            max_n = atoi(argv[++arg_i]);
+        else if (strcmp(argv[arg_i], "--max-ref-n") == 0 && arg_i + 1 < argc)
+            max_ref_n = atoi(argv[++arg_i]);
+        else
+            printf("WARNING: unrecognized option %s\n", argv[arg_i]);
+    }
+
+    // doubling sizes (see the bytes column): 32-64 fit L1, 128-256 fit L2, 512-1024 fit a
+    // typical L3; from 2048 on (32 MB) the matrix only fits in memory
+    printf("n,bytes,rec_lu_us,eliminate_us,decompose_us,rec_lu_gflops\n");
+    for (int n = 32; n <= max_n; n *= 2)
+    {
+        double (*M)[n] = malloc(sizeof(double) * n * n);
+        double (*A)[n] = malloc(sizeof(double) * n * n);
+        int* ipiv = malloc(sizeof(int) * n);
+        for (int i = 0; i < n; i++)
+        {
+            for (int j = 0; j < n; j++)
+            {
+                M[i][j] = rand() % 100;
+            }
+        }
+
+        struct timeval begin;
+        memcpy(A, M, sizeof(double) * n * n);
+        gettimeofday(&begin, 0);
+        rec_lu(n, A, ipiv);
+        long rec_us = get_elapsed_us(&begin);
+
+        long elim_us = -1;
+        if (n <= max_ref_n)
+        {
+            memcpy(A, M, sizeof(double) * n * n);
+            gettimeofday(&begin, 0);
+            eliminate(n, n, A, true, false, 15);
+            elim_us = get_elapsed_us(&begin);
+        }
+
+        double (*L)[n] = calloc((size_t)n * n, sizeof(double));
+        double (*U)[n] = calloc((size_t)n * n, sizeof(double));
+        gettimeofday(&begin, 0);
+        decompose(n, M, L, U, -1);
+        long crout_us = get_elapsed_us(&begin);
+        free(L);
+        free(U);
+
+        double gflops = 2.0 / 3.0 * n * (double)n * n / (rec_us > 0 ? rec_us : 1) * 1e-3;
+        printf("%d,%ld,%ld,%ld,%ld,%.3f\n", n, (long)sizeof(double) * n * n, rec_us, elim_us, crout_us, gflops);
+        fflush(stdout);
+
+        free(M);
+        free(A);
+        free(ipiv);
+    }
+
+    return 0;
+#endif
+}
+
+/**
+ * Factorizes the nxn matrix A in place into P*A = L*U, L unit lower triangular.
+ * ipiv[k] is the row interchanged with row k at step k.
+ * Returns 0 on success and -1 if a zero pivot was found.
+ */
+int rec_lu(int n, double A[][n], int* ipiv)
+{
+    return factor(n, n, n, A, ipiv);
+}
+
+/**
+ * Solves A x = b with the output of rec_lu(); x overwrites b.
+ */
+void rec_lu_solve(int n, double A[][n], const int* ipiv, double* b)
+{
+    for (int k = 0; k < n; k++)
+    {
+        double t = b[k];
+        b[k] = b[ipiv[k]];
+        b[ipiv[k]] = t;
+    }
+    for (int i = 0; i < n; i++)
+    {
+        double sum = 0;
+        for (int k = 0; k < i; k++) sum += A[i][k] * b[k];
+        b[i] -= sum;
+    }
+    for (int i = n - 1; i >= 0; i--)
+    {
+        double sum = 0;
+        for (int k = i + 1; k < n; k++) sum += A[i][k] * b[k];
+        b[i] = (b[i] - sum) / A[i][i];
+    }
+}
+
+// the recursion and its base cases work on parts of the matrix in place: a part
+// starts at X[r][c] and keeps the leading dimension ld of the whole matrix
+#define PART_AT(X, ld, r, c) ((double (*)[ld])&(X)[r][c])
+
+/**
+ * LU of the m x n panel A (m >= n); ipiv is relative to the first row of the panel.
+ */
+static int factor(int m, int n, int lda, double A[][lda], int* ipiv)
+{
+    if (n <= BASE_COLUMNS) return factor_base(m, n, lda, A, ipiv);
+
+    int n1 = n / 2;
+    int n2 = n - n1;
+    int ret = factor(m, n1, lda, A, ipiv);
+
+    // [A12; A22] gets the left half's interchanges, then A12 = L11^-1 A12, A22 -= A21 A12
+    apply_swaps(n1, n, lda, A, 0, n1, ipiv);
+    trsm_lower_unit(n1, n2, lda, A, lda, PART_AT(A, lda, 0, n1));
+    gemm_sub(m - n1, n2, n1, lda, PART_AT(A, lda, n1, 0), lda, PART_AT(A, lda, 0, n1), lda, PART_AT(A, lda, n1, n1));
+
+    ret |= factor(m - n1, n2, lda, PART_AT(A, lda, n1, n1), ipiv + n1);
+    for (int k = n1; k < n; k++)
+    {
+        ipiv[k] += n1;
+    }
+    apply_swaps(0, n1, lda, A, n1, n, ipiv);
+
+    return ret;
+}
+
+/**
+ * Right-looking LU of a narrow m x n panel, BASE_GROUP columns at a time: the
+ * columns of a group are factorized with rank-1 updates among themselves, then
+ * the rest of the panel gets the group's U rows from a triangular solve and one
+ * rank-BASE_GROUP update through gemm_kernel().
+ */
+static int factor_base(int m, int n, int lda, double A[][lda], int* ipiv)
+{
+    int ret = 0;
+    for (int k0 = 0; k0 < n; k0 += BASE_GROUP)
+    {
+        int k1 = (k0 + BASE_GROUP < n) ? k0 + BASE_GROUP : n;
+        for (int k = k0; k < k1; k++)
+        {
+            int p = k;
+            double max = fabs(A[k][k]);
+            for (int i = k + 1; i < m; i++)
+            {
+                if (max < fabs(A[i][k]))
+                {
+                    max = fabs(A[i][k]);
+                    p = i;
+                }
+            }
+            ipiv[k] = p;
+            if (p != k)
+            {
+                for (int j = 0; j < n; j++)
+                {
+                    double t = A[k][j];
+                    A[k][j] = A[p][j];
+                    A[p][j] = t;
+                }
+            }
+            if (A[k][k] == 0)
+            {
+                ret = -1;
+                continue;
+            }
+
+            double pivot = A[k][k];
+            for (int i = k + 1; i < m; i++)
+            {
+                double multiplier = A[i][k] / pivot;
+                A[i][k] = multiplier;
+                for (int j = k + 1; j < k1; j++)
+                {
+                    A[i][j] -= multiplier * A[k][j];
+                }
+            }
+        }
+
+        if (k1 < n)
+        {
+            trsm_lower_unit(k1 - k0, n - k1, lda, PART_AT(A, lda, k0, k0), lda, PART_AT(A, lda, k0, k1));
+            gemm_kernel(m - k1, n - k1, k1 - k0, lda, PART_AT(A, lda, k1, k0), lda, PART_AT(A, lda, k0, k1), lda, PART_AT(A, lda, k1, k1));
+        }
+    }
+    return ret;
+}
+
+/**
+ * Applies interchanges ipiv[k0..k1) to columns c0..c1-1.
+ */
+static void apply_swaps(int c0, int c1, int lda, double A[][lda], int k0, int k1, const int* ipiv)
+{
+    for (int k = k0; k < k1; k++)
+    {
+        int p = ipiv[k];
+        if (p == k) continue;
+        for (int j = c0; j < c1; j++)
+        {
+            double t = A[k][j];
+            A[k][j] = A[p][j];
+            A[p][j] = t;
+        }
+    }
+}
+
+/**
+ * B = L^-1 B for the n x n unit lower triangular L and the n x p matrix B.
+ */
+static void trsm_lower_unit(int n, int p, int lda, double L[][lda], int ldb, double B[][ldb])
+{
+    if (n <= BASE_TRSM)
+    {
+        // BASE_GROUP rows at a time: the rows above the group come in as one
+        // rank-i0 update on the kernel's 4 x 8 tiles, then the rows within the group
+        for (int i0 = 0; i0 < n; i0 += BASE_GROUP)
+        {
+            int rows = (n - i0 < BASE_GROUP) ? n - i0 : BASE_GROUP;
+            if (i0 > 0) gemm_kernel(rows, p, i0, lda, PART_AT(L, lda, i0, 0), ldb, B, ldb, PART_AT(B, ldb, i0, 0));
+            for (int i = i0 + 1; i < i0 + rows; i++)
+            {
+                gemm_kernel(1, p, i - i0, lda, PART_AT(L, lda, i, i0), ldb, PART_AT(B, ldb, i0, 0), ldb, PART_AT(B, ldb, i, 0));
+            }
+        }
+        return;
+    }
+
+    int n1 = n / 2;
+    trsm_lower_unit(n1, p, lda, L, ldb, B);
+    gemm_sub(n - n1, p, n1, lda, PART_AT(L, lda, n1, 0), ldb, B, ldb, PART_AT(B, ldb, n1, 0));
+    trsm_lower_unit(n - n1, p, lda, PART_AT(L, lda, n1, n1), ldb, PART_AT(B, ldb, n1, 0));
+}
+
+/**
+ * C -= A * B with A m x k and B k x n, halving the largest dimension until
+ * the blocks are small enough for the kernel.
+ */
+static void gemm_sub(int m, int n, int k, int lda, double A[][lda], int ldb, double B[][ldb], int ldc, double C[][ldc])
+{
+    if (m == 0 || n == 0 || k == 0) return;
+    if (m <= BASE_GEMM && n <= BASE_GEMM && k <= BASE_GEMM)
+    {
+        gemm_kernel(m, n, k, lda, A, ldb, B, ldc, C);
+    }
+    else if (m >= n && m >= k)
+    {
+        int m1 = m / 2;
+        gemm_sub(m1, n, k, lda, A, ldb, B, ldc, C);
+        gemm_sub(m - m1, n, k, lda, PART_AT(A, lda, m1, 0), ldb, B, ldc, PART_AT(C, ldc, m1, 0));
+    }
+    else if (n >= k)
+    {
+        int n1 = n / 2;
+        gemm_sub(m, n1, k, lda, A, ldb, B, ldc, C);
+        gemm_sub(m, n - n1, k, lda, A, ldb, PART_AT(B, ldb, 0, n1), ldc, PART_AT(C, ldc, 0, n1));
+    }
+    else
+    {
+        int k1 = k / 2;
+        gemm_sub(m, n, k1, lda, A, ldb, B, ldc, C);
+        gemm_sub(m, n, k - k1, lda, PART_AT(A, lda, 0, k1), ldb, PART_AT(B, ldb, k1, 0), ldc, C);
+    }
+}
+
+#undef PART_AT
+
+/**
+ * C -= A * B on blocks that fit in cache: 4 rows x 8 columns of C are kept in
+ * registers while the whole k dimension streams through.
+ */
+static void gemm_kernel(int m, int n, int k, int lda, double A[][lda], int ldb, double B[][ldb], int ldc, double C[][ldc])
+{
+    int m4 = m - m % 4;
+    int n8 = n - n % 8;
+    for (int i = 0; i < m4; i += 4)
+    {
+        for (int j = 0; j < n8; j += 8)
+        {
+#if defined(__AVX2__) && defined(__FMA__)
+            __m256d c00 = _mm256_setzero_pd(), c01 = _mm256_setzero_pd();
+            __m256d c10 = _mm256_setzero_pd(), c11 = _mm256_setzero_pd();
+            __m256d c20 = _mm256_setzero_pd(), c21 = _mm256_setzero_pd();
+            __m256d c30 = _mm256_setzero_pd(), c31 = _mm256_setzero_pd();
+            for (int p = 0; p < k; p++)
+            {
+                __m256d b0 = _mm256_loadu_pd(&B[p][j]);
+                __m256d b1 = _mm256_loadu_pd(&B[p][j + 4]);
+                __m256d a = _mm256_broadcast_sd(&A[i][p]);
+                c00 = _mm256_fmadd_pd(a, b0, c00);
+                c01 = _mm256_fmadd_pd(a, b1, c01);
+                a = _mm256_broadcast_sd(&A[i + 1][p]);
+                c10 = _mm256_fmadd_pd(a, b0, c10);
+                c11 = _mm256_fmadd_pd(a, b1, c11);
+                a = _mm256_broadcast_sd(&A[i + 2][p]);
+                c20 = _mm256_fmadd_pd(a, b0, c20);
+                c21 = _mm256_fmadd_pd(a, b1, c21);
+                a = _mm256_broadcast_sd(&A[i + 3][p]);
+                c30 = _mm256_fmadd_pd(a, b0, c30);
+                c31 = _mm256_fmadd_pd(a, b1, c31);
+            }
+            _mm256_storeu_pd(&C[i][j], _mm256_sub_pd(_mm256_loadu_pd(&C[i][j]), c00));
+            _mm256_storeu_pd(&C[i][j + 4], _mm256_sub_pd(_mm256_loadu_pd(&C[i][j + 4]), c01));
+            _mm256_storeu_pd(&C[i + 1][j], _mm256_sub_pd(_mm256_loadu_pd(&C[i + 1][j]), c10));
+            _mm256_storeu_pd(&C[i + 1][j + 4], _mm256_sub_pd(_mm256_loadu_pd(&C[i + 1][j + 4]), c11));
+            _mm256_storeu_pd(&C[i + 2][j], _mm256_sub_pd(_mm256_loadu_pd(&C[i + 2][j]), c20));
+            _mm256_storeu_pd(&C[i + 2][j + 4], _mm256_sub_pd(_mm256_loadu_pd(&C[i + 2][j + 4]), c21));
+            _mm256_storeu_pd(&C[i + 3][j], _mm256_sub_pd(_mm256_loadu_pd(&C[i + 3][j]), c30));
+            _mm256_storeu_pd(&C[i + 3][j + 4], _mm256_sub_pd(_mm256_loadu_pd(&C[i + 3][j + 4]), c31));
+#else
+            double c[4][8] = { { 0 } };
+            for (int p = 0; p < k; p++)
+            {
+                for (int r = 0; r < 4; r++)
+                {
+                    double a = A[i + r][p];
+                    for (int q = 0; q < 8; q++)
+                    {
+                        c[r][q] += a * B[p][j + q];
+                    }
+                }
+            }
+            for (int r = 0; r < 4; r++)
+            {
+                for (int q = 0; q < 8; q++)
+                {
+                    C[i + r][j + q] -= c[r][q];
+                }
+            }
+#endif
+        }
+    }
+
+    // edges: the last m % 4 rows, and the last n % 8 columns of the other rows
+    for (int i = 0; i < m; i++)
+    {
+        int j0 = (i < m4) ? n8 : 0;
+        for (int p = 0; p < k; p++)
+        {
+            double a = A[i][p];
+            for (int j = j0; j < n; j++)
+            {
+                C[i][j] -= a * B[p][j];
+            }
+        }
+    }
+}
+
+#ifndef TEST
+static long get_elapsed_us(struct timeval* begin)
+{
+    struct timeval end;
+    gettimeofday(&end, 0);
+    long seconds = end.tv_sec - begin->tv_sec;
+    long microseconds = end.tv_usec - begin->tv_usec;
+    long elapsed = seconds * 1e6 + microseconds;
+
+    return elapsed;
+}
+#endif
@@ -1,80 +1,313 @@
+// vim: noai:ts=4:sw=4
+
+/*
+recipe:
+> `gcc --std=c99 -O2 -fopenmp -DNOMAIN -DHIDEDUP gausselim.c crout.c testgausselimpivoting.c -o testgausselimpivoting -lm`
+> run: `./testgausselimpivoting [--max-n <n>] [--threads <p>] [--refine <steps>] [--budget <error>] [--seed <s>]`
+
+Accuracy vs speed sweep of the rounded precision paths.
+For every matrix size n and condition number cond a matrix with singular
+values spaced geometrically from 1 down to 1/cond is generated, and
+A x = b with x = (1, ..., 1) is solved
+
+    - rounded: gauss_elim() at the given number of digits, with the input
+      rounded to the same digits, with and without partial pivoting.
+    - mixed: decompose() at the given number of digits, then iterative
+      refinement with the residual and the corrections in full double
+      precision (Crout has no pivoting).
+
+For each point the relative residual |b - A x| / (|A| |x| + |b|), the forward
+error |x - 1| / |1| (infinity norms) and the wall time are written as CSV.
+The points of a (n, cond) pair that no other point beats in both time and
+forward error form the Pareto frontier and are marked in the pareto column.
+With --budget the cheapest point with a forward error within the budget is
+listed for every (n, cond) pair.
+
+The points are independent and run in parallel; the time of a point is the
+time of its own solve, so it is only comparable between points of one run.
+*/
+
 #include <stdio.h>
 #include <stdlib.h>
-#include <math.h>
+#include <string.h>
 #include <stdbool.h>
-#include <time.h>
+#include <math.h>
+#include <omp.h>
 
-extern int eliminate(int m, int n, double A[][n], bool do_partial_pivoting, bool augmented_matrix, int precision);
-extern int substitute(int m, int n, double A[][n], double* x, int precision);
 extern int gauss_elim(int m, int n, double A[][n], double* x, bool do_partial_pivoting, bool augmented_matrix, int precision);
 extern double round_to_digits(double value, int digits);
+extern void decompose(int n, double A[][n], double L[][n], double U[][n], int precision);
+extern void forward_substitution(int n, double L[][n], double y[n], double b[n]);
+extern void backward_substitution(int n, double U[][n], double x[n], double y[n]);
 
-// https://stackoverflow.com/a/13409133
-float randf(float min, float max)
+enum mode { MODE_ROUNDED, MODE_MIXED };
+
+/** one point of the sweep and its measurements **/
+struct point
 {
-    float x = (float)rand()/(float)(RAND_MAX/max) + min;
-    return x;
-}
+    int n;
+    double cond;
+    int digits;
+    enum mode mode;
+    bool pivoting;
+    double residual;
+    double forward_error;
+    double seconds;
+    bool pareto;
+};
 
-int main()
+static void generate(int n, double cond, unsigned long long seed, double A[][n]);
+static double uniform(unsigned long long* state);
+static void run_point(struct point* p, int refine_steps, unsigned long long seed);
+static double infinity_norm(int n, double A[][n]);
+static bool dominates(const struct point* a, const struct point* b);
+
+int main(int argc, char** argv)
 {
-    // generate random agumented matrix A of size n
-    srand(time(NULL));
+    /** input: parse command line arguments **/
+    int max_n = 64;
+    int threads = omp_get_max_threads();
+    int refine_steps = 3;
+    double budget = -1;
+    unsigned long long seed = 1;
+    for (int arg_i = 1; arg_i < argc; arg_i++)
+    {
+        if (strcmp(argv[arg_i], "--max-n") == 0 && arg_i + 1 < argc)
+            max_n = atoi(argv[++arg_i]);
+        else if (strcmp(argv[arg_i], "--threads") == 0 && arg_i + 1 < argc)
+            threads = atoi(argv[++arg_i]);
+        else if (strcmp(argv[arg_i], "--refine") == 0 && arg_i + 1 < argc)
+            refine_steps = atoi(argv[++arg_i]);
+        else if (strcmp(argv[arg_i], "--budget") == 0 && arg_i + 1 < argc)
+            budget = atof(argv[++arg_i]);
+        else if (strcmp(argv[arg_i], "--seed") == 0 && arg_i + 1 < argc)
+            seed = strtoull(argv[++arg_i], NULL, 10);
+        else
+            printf("WARNING: unrecognized option %s\n", argv[arg_i]);
+    }
+    omp_set_num_threads(threads);
 
-    int n = 2;
-    double M[n][n+1];
-    for (int i = 0; i < n; i++)
+    double conds[] = { 1e1, 1e4, 1e8, 1e12 };
+    int digits[] = { 3, 4, 6, 8, 10, 12, 15 };
+    int num_conds = sizeof(conds)/sizeof(double);
+    int num_digits = sizeof(digits)/sizeof(int);
+    int num_sizes = 0;
+    for (int n = 8; n <= max_n; n *= 2) num_sizes++;
+
+    // rounded with pivoting, rounded without, mixed
+    int per_pair = num_digits * 3;
+    int num_points = num_sizes * num_conds * per_pair;
+    struct point* points = malloc(sizeof(struct point) * num_points);
+    int p = 0;
+    for (int n = 8; n <= max_n; n *= 2)
     {
-        for (int j = 0; j <= n; j++)
+        for (int c = 0; c < num_conds; c++)
         {
-            M[i][j] = randf(-10, 10);
+            for (int d = 0; d < num_digits; d++)
+            {
+                points[p++] = (struct point){ .n = n, .cond = conds[c], .digits = digits[d], .mode = MODE_ROUNDED, .pivoting = true };
+                points[p++] = (struct point){ .n = n, .cond = conds[c], .digits = digits[d], .mode = MODE_ROUNDED, .pivoting = false };
+                points[p++] = (struct point){ .n = n, .cond = conds[c], .digits = digits[d], .mode = MODE_MIXED, .pivoting = false };
+            }
         }
     }
 
-    for (int d = 3; d <= 6; d++)
+    // the largest systems first so that they don't end up last on a single thread
+    #pragma omp parallel for schedule(dynamic)
+    for (int i = num_points - 1; i >= 0; i--)
     {
-        double A[n][n+1];
-        for (int i = 0; i < n; i++)
+        // same seed for all points of a (n, cond) pair, so they solve the same system
+        run_point(&points[i], refine_steps, seed + i / per_pair);
+    }
+
+    for (int g = 0; g < num_points; g += per_pair)
+    {
+        for (int i = g; i < g + per_pair; i++)
         {
-            for (int j = 0; j <= n; j++)
+            points[i].pareto = isfinite(points[i].forward_error);
+            for (int j = g; j < g + per_pair && points[i].pareto; j++)
             {
-                A[i][j] = round_to_digits(M[i][j], d);
+                if (j != i && dominates(&points[j], &points[i])) points[i].pareto = false;
             }
         }
-        // copy for without pivoting
-        double AA[n][n+1];
-        for (int i = 0; i < n; i++)
+    }
+
+    printf("n,cond,mode,pivoting,digits,relative_residual,forward_error,seconds,pareto\n");
+    for (int i = 0; i < num_points; i++)
+    {
+        struct point* q = &points[i];
+        printf("%d,%.0e,%s,%d,%d,%.3e,%.3e,%.6f,%d\n", q->n, q->cond,
+            q->mode == MODE_MIXED ? "mixed" : "rounded", q->pivoting, q->digits,
+            q->residual, q->forward_error, q->seconds, q->pareto);
+    }
+
+    if (budget > 0)
+    {
+        printf("\nn,cond,budget,mode,pivoting,digits,forward_error,seconds\n");
+        for (int g = 0; g < num_points; g += per_pair)
         {
-            for (int j = 0; j <= n; j++)
+            struct point* best = NULL;
+            for (int i = g; i < g + per_pair; i++)
             {
-                AA[i][j] = A[i][j];
+                if (points[i].forward_error <= budget && (best == NULL || points[i].seconds < best->seconds))
+                    best = &points[i];
             }
+            if (best == NULL)
+                printf("%d,%.0e,%.0e,none,,,,\n", points[g].n, points[g].cond, budget);
+            else
+                printf("%d,%.0e,%.0e,%s,%d,%d,%.3e,%.6f\n", best->n, best->cond, budget,
+                    best->mode == MODE_MIXED ? "mixed" : "rounded", best->pivoting, best->digits,
+                    best->forward_error, best->seconds);
         }
+    }
 
-        // run Gaussian elimination and substitution on A and measure time taken for each
-        double x[n];
-        int ret = gauss_elim(n, n + 1, A, x, true, true, d);
+    free(points);
+    return 0;
+}
 
-        if (ret == 0)
+/**
+ * Solves the system of point p and fills in its measurements.
+ */
+static void run_point(struct point* p, int refine_steps, unsigned long long seed)
+{
+    int n = p->n;
+    double (*A)[n] = malloc(sizeof(double) * n * n);
+    double (*E)[n + 1] = malloc(sizeof(double) * n * (n + 1));
+    double b[n], x[n], r[n], y[n];
+    generate(n, p->cond, seed, A);
+    for (int i = 0; i < n; i++)
+    {
+        b[i] = 0;
+        for (int j = 0; j < n; j++) b[i] += A[i][j];
+    }
+
+    // the rounded input is part of the problem, not of the solve
+    if (p->mode == MODE_ROUNDED)
+    {
+        for (int i = 0; i < n; i++)
         {
-            printf("\nOutput with pivoting\n");
-            for (int i = 0; i < sizeof(x)/sizeof(double); i++)
-            {
-                printf("x[%d] = %8.6f\n", i, x[i]);
-            }
+            for (int j = 0; j < n; j++) E[i][j] = round_to_digits(A[i][j], p->digits);
+            E[i][n] = round_to_digits(b[i], p->digits);
         }
+    }
 
-        double xx[n];
-        ret = gauss_elim(n, n + 1, AA, xx, false, true, d);
-        if (ret == 0)
+    double start = omp_get_wtime();
+    if (p->mode == MODE_ROUNDED)
+    {
+        if (gauss_elim(n, n + 1, E, x, p->pivoting, true, p->digits) != 0)
+        {
+            for (int i = 0; i < n; i++) x[i] = NAN;
+        }
+    }
+    else
+    {
+        double (*L)[n] = calloc((size_t)n * n, sizeof(double));
+        double (*U)[n] = calloc((size_t)n * n, sizeof(double));
+        decompose(n, A, L, U, p->digits);
+        forward_substitution(n, L, y, b);
+        backward_substitution(n, U, x, y);
+        for (int step = 0; step < refine_steps; step++)
         {
-            printf("\nOutput without pivoting\n");
-            for (int i = 0; i < sizeof(xx)/sizeof(double); i++)
+            for (int i = 0; i < n; i++)
             {
-                printf("xx[%d] = %8.6f\n", i, xx[i]);
+                r[i] = b[i];
+                for (int j = 0; j < n; j++) r[i] -= A[i][j] * x[j];
             }
+            forward_substitution(n, L, y, r);
+            backward_substitution(n, U, r, y);
+            for (int i = 0; i < n; i++) x[i] += r[i];
         }
+        free(L);
+        free(U);
     }
+    p->seconds = omp_get_wtime() - start;
 
-    return 0;
+    // fmax() skips NaNs, so a failed solve is carried separately
+    bool finite = true;
+    double max_r = 0, max_b = 0, max_x = 0, max_e = 0;
+    for (int i = 0; i < n; i++)
+    {
+        double ri = b[i];
+        for (int j = 0; j < n; j++) ri -= A[i][j] * x[j];
+        max_r = fmax(max_r, fabs(ri));
+        max_b = fmax(max_b, fabs(b[i]));
+        max_x = fmax(max_x, fabs(x[i]));
+        max_e = fmax(max_e, fabs(x[i] - 1));
+        finite = finite && isfinite(x[i]);
+    }
+    p->residual = finite ? max_r / (infinity_norm(n, A) * max_x + max_b) : NAN;
+    p->forward_error = finite ? max_e : NAN;
+
+    free(A);
+    free(E);
+}
+
+/**
+ * A = (I - 2 u u') S (I - 2 v v') with S = diag(1, ..., 1/cond) spaced geometrically.
+ * The Householder reflections are orthogonal, so the singular values of A are those of S.
+ */
+static void generate(int n, double cond, unsigned long long seed, double A[][n])
+{
+    unsigned long long state = seed * 0x9E3779B97F4A7C15ULL + 1;
+    double u[n], v[n], s[n];
+    double nu = 0, nv = 0;
+    for (int i = 0; i < n; i++)
+    {
+        u[i] = uniform(&state) - 0.5;
+        v[i] = uniform(&state) - 0.5;
+        nu += u[i] * u[i];
+        nv += v[i] * v[i];
+        s[i] = (n == 1) ? 1 : pow(cond, -(double)i / (n - 1));
+    }
+    nu = sqrt(nu);
+    nv = sqrt(nv);
+    for (int i = 0; i < n; i++)
+    {
+        u[i] /= nu;
+        v[i] /= nv;
+    }
+
+    // (I - 2 u u') S (I - 2 v v') = S - 2 u (S' u)' - 2 (S v) v' + 4 (u' S v) u v'
+    double usv = 0;
+    for (int i = 0; i < n; i++) usv += u[i] * s[i] * v[i];
+    for (int i = 0; i < n; i++)
+    {
+        for (int j = 0; j < n; j++)
+        {
+            A[i][j] = (i == j ? s[i] : 0) - 2 * u[i] * s[j] * u[j] - 2 * s[i] * v[i] * v[j] + 4 * usv * u[i] * v[j];
+        }
+    }
+}
+
+/**
+ * Uniform in [0, 1) from a xorshift64* generator, so that every point has its own stream.
+ */
+static double uniform(unsigned long long* state)
+{
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return ((*state * 0x2545F4914F6CDD1DULL) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static double infinity_norm(int n, double A[][n])
+{
+    double max = 0;
+    for (int i = 0; i < n; i++)
+    {
+        double sum = 0;
+        for (int j = 0; j < n; j++) sum += fabs(A[i][j]);
+        if (max < sum) max = sum;
+    }
+    return max;
+}
+
+/**
+ * a is at least as fast and as accurate as b, and better in one of the two.
+ */
+static bool dominates(const struct point* a, const struct point* b)
+{
+    if (!isfinite(a->forward_error)) return false;
+    return a->seconds <= b->seconds && a->forward_error <= b->forward_error
+        && (a->seconds < b->seconds || a->forward_error < b->forward_error);
 }
@@ -0,0 +1,513 @@
+// vim: noai:ts=4:sw=4
+
+/*
+recipe:
+> `gcc --std=c99 -O3 -march=native -fopenmp tiledlu.c -o tiledlu -lm`
+> run: `./tiledlu [--trace <file>] [--threads <p>] <n> <nb>`
+> define TEST macro for running tests: `gcc --std=c99 -fopenmp -DTEST tiledlu.c -o tiledlu -lm`
+> define NOMAIN macro for compiling without main()
+
+Tiled LU decomposition with partial pivoting, scheduled as a DAG of OpenMP tasks.
+The matrix is split into nb x nb tiles. For every step k there is
+    - one panel task factorizing the tile column k (rows k*nb..n-1),
+    - one swap/trsm task per tile column j > k, applying the panel's row
+      interchanges to column j and solving the unit lower triangular L_kk,
+    - one gemm task per trailing tile (i, j), doing A_ij -= A_ik * A_kj.
+Dependencies are expressed on a nt x nt array of tile tokens, so the panel of
+step k+1 starts as soon as tile column k+1 has been updated, while the rest of
+the trailing update of step k is still running (lookahead).
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <math.h>
+#include <omp.h>
+#ifdef TEST
+#include <assert.h>
+#endif
+
+int tiled_lu(int n, double A[][n], int* ipiv, int nb);
+void tiled_lu_solve(int n, double A[][n], const int* ipiv, double* b);
+
+void tiled_lu_trace_begin(int capacity);
+void tiled_lu_trace_dump(FILE* out);
+void tiled_lu_trace_end();
+
+static void panel_factorize(int n, double A[][n], int* ipiv, int c0, int c1, int* singular);
+static void swap_trsm(int n, double A[][n], const int* ipiv, int c0, int c1, int cj0, int cj1);
+static void gemm_update(int n, double A[][n], int r0, int r1, int c0, int c1, int cj0, int cj1);
+static void apply_swaps(int n, double A[][n], const int* ipiv, int c0, int c1, int cj0, int cj1);
+
+static void trace_record(char kind, int k, int i, int j, double start);
+
+/** task timeline, only collected between tiled_lu_trace_begin() and tiled_lu_trace_end() **/
+struct trace_event
+{
+    int thread;
+    char kind;      // 'P' panel, 'T' swap/trsm, 'G' gemm
+    int k, i, j;
+    double start, end;
+};
+
+static struct trace_event* trace_events = NULL;
+static int trace_capacity = 0;
+static int trace_count = 0;
+static double trace_epoch = 0;
+
+#ifdef TEST
+#define EPSILON 0.0001
+void test_1()
+{
+    double A[5][5] = {
+        { 13, 4, 5, 0, 9 },
+        { 33, -2, -7, 8, 0 },
+        { 23, 32, 9, 5, 1 },
+        { 54, 34, 87, 2, 4 },
+        { -5, 6, 7, 8, 9 }
+    };
+    double b[5] = { 101, 3, 7, 66, 10 };
+    int ipiv[5];
+
+    // nb = 2 gives a 3x3 tile grid with ragged tiles at the edge
+    int ret = tiled_lu(5, A, ipiv, 2);
+    assert(ret == 0);
+    tiled_lu_solve(5, A, ipiv, b);
+
+    assert(fabs(b[0] - 1.7424) <= EPSILON);
+    assert(fabs(b[1] - -0.0149) <= EPSILON);
+    assert(fabs(b[2] - -0.5640) <= EPSILON);
+    assert(fabs(b[3] - -7.3098) <= EPSILON);
+    assert(fabs(b[4] - 9.0253) <= EPSILON);
+}
+
+void test_2()
+{
+    // every tile size must give the same factorization as a single tile
+    int n = 37;
+    double (*A)[n] = malloc(sizeof(double) * n * n);
+    double (*B)[n] = malloc(sizeof(double) * n * n);
+    int ipiv_a[n], ipiv_b[n];
+    srand(7);
+    for (int i = 0; i < n; i++)
+    {
+        for (int j = 0; j < n; j++)
+        {
+            A[i][j] = B[i][j] = rand() % 100 - 50;
+        }
+    }
+
+    assert(tiled_lu(n, A, ipiv_a, n) == 0);
+    assert(tiled_lu(n, B, ipiv_b, 5) == 0);
+    for (int i = 0; i < n; i++)
+    {
+        assert(ipiv_a[i] == ipiv_b[i]);
+        for (int j = 0; j < n; j++)
+        {
+            assert(fabs(A[i][j] - B[i][j]) <= EPSILON);
+        }
+    }
+
+    free(A);
+    free(B);
+}
+#endif
+
+#ifndef NOMAIN
+int main(int argc, char** argv)
+{
+#ifdef TEST
+    printf("Running tests\n");
+    test_1();
+    test_2();
+    printf("Finished running tests\n");
+
+    return 0;
+#else
+    /** input: parse command line arguments **/
+    const char* trace_file = NULL;
+    int max_threads = omp_get_max_threads();
+    int arg_i = 1;
+    while (arg_i < argc && strncmp(argv[arg_i], "--", 2) == 0)
+    {
+        if (strcmp(argv[arg_i], "--trace") == 0 && arg_i + 1 < argc)
+        {
+            trace_file = argv[++arg_i];
+        }
+        else if (strcmp(argv[arg_i], "--threads") == 0 && arg_i + 1 < argc)
+        {
+            max_threads = atoi(argv[++arg_i]);
+        }
+        else
+        {
+            printf("WARNING: unrecognized option %s\n", argv[arg_i]);
+        }
+        arg_i++;
+    }
+    if (argc - arg_i < 2)
+    {
+        printf("ERROR: usage: tiledlu [--trace <file>] [--threads <p>] <n> <nb>\n");
+        return -1;
+    }
+    int n = atoi(argv[arg_i]);
+    int nb = atoi(argv[arg_i + 1]);
+    if (n < 1 || nb < 1 || max_threads < 1)
+    {
+        printf("ERROR: n, nb and the thread count must be positive\n");
+        return -1;
+    }
+
+    double (*M)[n] = malloc(sizeof(double) * n * n);
+    double (*A)[n] = malloc(sizeof(double) * n * n);
+    double* x = malloc(sizeof(double) * n);
+    int* ipiv = malloc(sizeof(int) * n);
+    for (int i = 0; i < n; i++)
+    {
+        for (int j = 0; j < n; j++)
+        {
+            M[i][j] = (double)rand() / RAND_MAX - 0.5;
+        }
+    }
+
+    /** run: strong scaling over thread counts; the trace is taken from the last run **/
+    printf("threads,n,nb,seconds,gflops,max_error\n");
+    for (int p = 1; ; p = (p * 2 < max_threads) ? p * 2 : max_threads)
+    {
+        memcpy(A, M, sizeof(double) * n * n);
+        omp_set_num_threads(p);
+        if (trace_file != NULL && p == max_threads)
+        {
+            int nt = (n + nb - 1) / nb;
+            tiled_lu_trace_begin(nt * (nt + 1) * (2 * nt + 1) / 6 + nt * nt);
+        }
+
+        double start = omp_get_wtime();
+        int ret = tiled_lu(n, A, ipiv, nb);
+        double seconds = omp_get_wtime() - start;
+        if (ret != 0)
+        {
+            printf("ERROR: matrix is singular\n");
+            return ret;
+        }
+
+        // x solves A x = M * ones, so it should be all ones
+        for (int i = 0; i < n; i++)
+        {
+            x[i] = 0;
+            for (int j = 0; j < n; j++)
+            {
+                x[i] += M[i][j];
+            }
+        }
+        tiled_lu_solve(n, A, ipiv, x);
+        double max_error = 0;
+        for (int i = 0; i < n; i++)
+        {
+            max_error = fmax(max_error, fabs(x[i] - 1.0));
+        }
+
+        double gflops = 2.0 / 3.0 * n * (double)n * n / seconds * 1e-9;
+        printf("%d,%d,%d,%.6f,%.3f,%.3e\n", p, n, nb, seconds, gflops, max_error);
+
+        if (p == max_threads) break;
+    }
+
+    if (trace_file != NULL)
+    {
+        FILE* out = fopen(trace_file, "w");
+        if (out == NULL)
+        {
+            printf("ERROR: cannot open %s for writing\n", trace_file);
+            return -1;
+        }
+        tiled_lu_trace_dump(out);
+        fclose(out);
+        tiled_lu_trace_end();
+    }
+
+    free(M);
+    free(A);
+    free(x);
+    free(ipiv);
+    return 0;
+#endif
+}
+#endif	// NOMAIN
+
+/**
+ * Factorizes the nxn matrix A in place into P*A = L*U using nb x nb tiles.
+ * L is unit lower triangular (diagonal not stored) and U is upper triangular.
+ * ipiv[i] is the row that was interchanged with row i, in the order the
+ * interchanges were made (same as LAPACK's getrf, but 0-based).
+ * Returns 0 on success and -1 if a zero pivot was found.
+ */
+int tiled_lu(int n, double A[][n], int* ipiv, int nb)
+{
+    if (nb > n) nb = n;
+    int nt = (n + nb - 1) / nb;
+    int singular = 0;
+
+    // one dependency token per tile; only the addresses matter
+    char (*tile)[nt] = malloc(sizeof(char) * nt * nt);
+
+    #pragma omp parallel
+    #pragma omp single
+    {
+        for (int k = 0; k < nt; k++)
+        {
+            int c0 = k * nb;
+            int c1 = (c0 + nb < n) ? c0 + nb : n;
+
+            #pragma omp task depend(iterator(it = k:nt), inout: tile[it][k]) priority(2) \
+                shared(singular)
+            {
+                double start = omp_get_wtime();
+                panel_factorize(n, A, ipiv, c0, c1, &singular);
+                trace_record('P', k, k, k, start);
+            }
+
+            for (int j = k + 1; j < nt; j++)
+            {
+                int cj0 = j * nb;
+                int cj1 = (cj0 + nb < n) ? cj0 + nb : n;
+
+                #pragma omp task depend(in: tile[k][k]) \
+                    depend(iterator(it = k:nt), inout: tile[it][j]) priority(j == k + 1 ? 1 : 0)
+                {
+                    double start = omp_get_wtime();
+                    swap_trsm(n, A, ipiv, c0, c1, cj0, cj1);
+                    trace_record('T', k, k, j, start);
+                }
+            }
+
+            for (int j = k + 1; j < nt; j++)
+            {
+                int cj0 = j * nb;
+                int cj1 = (cj0 + nb < n) ? cj0 + nb : n;
+                for (int i = k + 1; i < nt; i++)
+                {
+                    int r0 = i * nb;
+                    int r1 = (r0 + nb < n) ? r0 + nb : n;
+
+                    #pragma omp task depend(in: tile[i][k], tile[k][j]) depend(inout: tile[i][j]) \
+                        priority(j == k + 1 ? 1 : 0)
+                    {
+                        double start = omp_get_wtime();
+                        gemm_update(n, A, r0, r1, c0, c1, cj0, cj1);
+                        trace_record('G', k, i, j, start);
+                    }
+                }
+            }
+        }
+    }
+
+    // interchanges of later panels still have to be applied to the L part on their left
+    #pragma omp parallel for schedule(dynamic)
+    for (int j = 0; j < nt - 1; j++)
+    {
+        int cj0 = j * nb;
+        int cj1 = (cj0 + nb < n) ? cj0 + nb : n;
+        apply_swaps(n, A, ipiv, cj1, n, cj0, cj1);
+    }
+
+    free(tile);
+    return singular ? -1 : 0;
+}
+
+/**
+ * Solves A x = b using the output of tiled_lu(); x overwrites b.
+ */
+void tiled_lu_solve(int n, double A[][n], const int* ipiv, double* b)
+{
+    for (int i = 0; i < n; i++)
+    {
+        double t = b[i];
+        b[i] = b[ipiv[i]];
+        b[ipiv[i]] = t;
+    }
+    // L y = Pb
+    for (int i = 0; i < n; i++)
+    {
+        double sum = 0;
+        for (int k = 0; k < i; k++)
+        {
+            sum += A[i][k] * b[k];
+        }
+        b[i] -= sum;
+    }
+    // U x = y
+    for (int i = n - 1; i >= 0; i--)
+    {
+        double sum = 0;
+        for (int k = i + 1; k < n; k++)
+        {
+            sum += A[i][k] * b[k];
+        }
+        b[i] = (b[i] - sum) / A[i][i];
+    }
+}
+
+/**
+ * Unblocked right-looking LU with partial pivoting on columns c0..c1-1 and
+ * rows c0..n-1. Row interchanges are applied to the panel columns only.
+ */
+static void panel_factorize(int n, double A[][n], int* ipiv, int c0, int c1, int* singular)
+{
+    for (int j = c0; j < c1; j++)
+    {
+        // pick the first row with the largest magnitude, like eliminate() does
+        int p = j;
+        double max = fabs(A[j][j]);
+        for (int i = j + 1; i < n; i++)
+        {
+            if (max < fabs(A[i][j]))
+            {
+                max = fabs(A[i][j]);
+                p = i;
+            }
+        }
+        ipiv[j] = p;
+        if (p != j)
+        {
+            for (int c = c0; c < c1; c++)
+            {
+                double t = A[j][c];
+                A[j][c] = A[p][c];
+                A[p][c] = t;
+            }
+        }
+        if (A[j][j] == 0)
+        {
+            #pragma omp atomic write
+            *singular = 1;
+            continue;
+        }
+
+        double pivot = A[j][j];
+        for (int i = j + 1; i < n; i++)
+        {
+            double* restrict row = A[i];
+            const double* restrict pivot_row = A[j];
+            double multiplier = row[j] / pivot;
+            row[j] = multiplier;
+            for (int c = j + 1; c < c1; c++)
+            {
+                row[c] -= multiplier * pivot_row[c];
+            }
+        }
+    }
+}
+
+/**
+ * Applies the interchanges of panel c0..c1-1 to columns cj0..cj1-1, then
+ * overwrites rows c0..c1-1 of those columns with L_kk^-1 * A_kj.
+ */
+static void swap_trsm(int n, double A[][n], const int* ipiv, int c0, int c1, int cj0, int cj1)
+{
+    apply_swaps(n, A, ipiv, c0, c1, cj0, cj1);
+
+    for (int r = c0 + 1; r < c1; r++)
+    {
+        double* restrict row = A[r];
+        for (int t = c0; t < r; t++)
+        {
+            double l = row[t];
+            const double* restrict upper = A[t];
+            for (int c = cj0; c < cj1; c++)
+            {
+                row[c] -= l * upper[c];
+            }
+        }
+    }
+}
+
+/**
+ * A[r0..r1)[cj0..cj1) -= A[r0..r1)[c0..c1) * A[c0..c1)[cj0..cj1)
+ */
+static void gemm_update(int n, double A[][n], int r0, int r1, int c0, int c1, int cj0, int cj1)
+{
+    for (int i = r0; i < r1; i++)
+    {
+        double* restrict row = A[i];
+        for (int t = c0; t < c1; t++)
+        {
+            double l = row[t];
+            if (l == 0) continue;
+            const double* restrict upper = A[t];
+            for (int c = cj0; c < cj1; c++)
+            {
+                row[c] -= l * upper[c];
+            }
+        }
+    }
+}
+
+/**
+ * Applies the interchanges recorded in ipiv[c0..c1) to columns cj0..cj1-1.
+ */
+static void apply_swaps(int n, double A[][n], const int* ipiv, int c0, int c1, int cj0, int cj1)
+{
+    for (int j = c0; j < c1; j++)
+    {
+        int p = ipiv[j];
+        if (p == j) continue;
+        for (int c = cj0; c < cj1; c++)
+        {
+            double t = A[j][c];
+            A[j][c] = A[p][c];
+            A[p][c] = t;
+        }
+    }
+}
+
+void tiled_lu_trace_begin(int capacity)
+{
+    free(trace_events);
+    trace_events = malloc(sizeof(struct trace_event) * capacity);
+    trace_capacity = trace_events != NULL ? capacity : 0;
+    trace_count = 0;
+    trace_epoch = omp_get_wtime();
+}
+
+/**
+ * Writes the recorded task timeline as CSV, one task per line, times in microseconds.
+ */
+void tiled_lu_trace_dump(FILE* out)
+{
+    int count = trace_count < trace_capacity ? trace_count : trace_capacity;
+    fprintf(out, "thread,kind,k,i,j,start_us,end_us\n");
+    for (int e = 0; e < count; e++)
+    {
+        struct trace_event* ev = &trace_events[e];
+        fprintf(out, "%d,%c,%d,%d,%d,%.1f,%.1f\n", ev->thread, ev->kind, ev->k, ev->i, ev->j,
+            (ev->start - trace_epoch) * 1e6, (ev->end - trace_epoch) * 1e6);
+    }
+}
+
+void tiled_lu_trace_end()
+{
+    free(trace_events);
+    trace_events = NULL;
+    trace_capacity = 0;
+    trace_count = 0;
+}
+
+static void trace_record(char kind, int k, int i, int j, double start)
+{
+    if (trace_capacity == 0) return;
+
+    int slot;
+    #pragma omp atomic capture
+    slot = trace_count++;
+    if (slot >= trace_capacity) return;
+
+    struct trace_event* ev = &trace_events[slot];
+    ev->thread = omp_get_thread_num();
+    ev->kind = kind;
+    ev->k = k;
+    ev->i = i;
+    ev->j = j;
+    ev->start = start;
+    ev->end = omp_get_wtime();
+}